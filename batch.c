@@ -0,0 +1,242 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "heap.h"
+#include "meshio.h"
+#include "lod.h"
+#include "outofcore.h"
+#include "cluster.h"
+#include "reorder.h"
+
+/**
+* Headless batch reducer. Loads an OFF file, reduces it to a target size
+* and writes the result without touching GL, reporting the wall time of
+* every phase so it can be used for throughput measurements. With -o the
+* reduction is split by reduceReordering into runs of every collapses,
+* reordering the mesh for locality between them.
+*/
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define MAX_LEVELS 32
+
+int reduceReordering(Mesh *mesh, const ReduceLimits *limits, int every, float dimensions[6]) {
+	ReduceLimits step = *limits;
+	int collapses = 0, done, reason;
+	if(every <= 0) {
+		reduceUntil(mesh, limits, &collapses);
+		return collapses;
+	}
+	do {
+		/* Each collapse removes two faces */
+		step.targetFaces = MAX(limits->targetFaces, mesh->numFaces - 2 * every);
+		reason = reduceUntil(mesh, &step, &done);
+		collapses += done;
+		if(reason == REDUCE_TARGET && mesh->numFaces > limits->targetFaces && mesh->numEdges > limits->targetEdges) {
+			reorderMesh(mesh, dimensions);
+		}
+	} while(reason == REDUCE_TARGET && mesh->numFaces > limits->targetFaces && mesh->numEdges > limits->targetEdges);
+	return collapses;
+}
+
+double getSeconds() {
+#ifdef _WIN32
+	return GetTickCount()/1000.0;
+#else
+	struct timeval time;
+	gettimeofday(&time, NULL);
+	return time.tv_sec + time.tv_usec/1000000.0;
+#endif
+}
+
+void usage(char *name) {
+	printf("Usage: %s [options] input.off output.off\n", name);
+	printf("  -f faces    Reduce until at most this many faces remain.\n");
+	printf("  -e edges    Reduce until at most this many half edges remain.\n");
+	printf("  -r ratio    Reduce to this fraction of the input faces (default 0.5).\n");
+	printf("  -c cost     Cost function, one of simple, melax or garland (default simple).\n");
+	printf("  -t threads  Worker threads for the parallel passes (default 1).\n");
+	printf("  -n          Do not read or write the binary cache next to the input.\n");
+	printf("  -p          Reduce in rounds of independent collapses spread over the threads.\n");
+	printf("  -l ratios   Comma separated face ratios in (0, 1], finest first and strictly\n");
+	printf("              decreasing. Every level is written to one level of detail file sharing\n");
+	printf("              a single vertex array.\n");
+	printf("  -g faces    Pre-decimate by vertex clustering on a grid to about this many faces before\n");
+	printf("              the heap based reduction.\n");
+	printf("  -q          Place clustered vertices by quadric instead of averaging them.\n");
+	printf("  -o every    Reorder the mesh along a Morton curve for locality after loading, and\n");
+	printf("              again after every this many collapses unless 0.\n");
+	printf("  -x cost     Stop before collapsing an edge costing more than this.\n");
+	printf("  -m size     Simplify out of core, holding about this many megabytes of the mesh in\n");
+	printf("              memory at a time. Only -f and -r targets are supported.\n");
+}
+
+int main(int argc, char **argv) {
+	char *input = NULL, *output = NULL;
+	int targetFaces = -1, targetEdges = -1;
+	float ratio = 0.5f, maxCost = INFINITY;
+	double budget = 0.0;
+	int clusterFaces = -1, useQuadrics = 0, reorderEvery = -1;
+	float levels[MAX_LEVELS];
+	int numLevels = 0;
+	LodExport *lods = NULL;
+	ReduceLimits limits;
+	float (*cost)(Edge*) = simpleCost;
+	float dimensions[6];
+	double start, loadTime, clusterTime = 0.0, reorderTime = 0.0, heapTime, reduceTime, writeTime;
+	int initFaces, initEdges, clustered = 0, collapses = 0, rounds = 0;
+	Mesh *mesh;
+	FILE *f;
+	int i;
+
+	for(i = 1; i < argc; i++) {
+		if(argv[i][0] == '-' && argv[i][1] != 0 && argv[i][2] == 0 && i + 1 < argc) {
+			switch(argv[i][1]) {
+				case 'f': targetFaces = atoi(argv[++i]); continue;
+				case 'e': targetEdges = atoi(argv[++i]); continue;
+				case 'r': ratio = atof(argv[++i]); continue;
+				case 't': meshThreads = atoi(argv[++i]); continue;
+				case 'g': clusterFaces = atoi(argv[++i]); continue;
+				case 'o': reorderEvery = atoi(argv[++i]); continue;
+				case 'm': budget = atof(argv[++i]); continue;
+				case 'x': maxCost = atof(argv[++i]); continue;
+				case 'l': {
+					char *token = strtok(argv[++i], ",");
+					for(numLevels = 0; token != NULL && numLevels < MAX_LEVELS; token = strtok(NULL, ",")) {
+						levels[numLevels] = atof(token);
+						/* The export assumes the levels go from finest to coarsest */
+						if(!(levels[numLevels] > 0.0f && levels[numLevels] <= 1.0f) ||
+								(numLevels > 0 && levels[numLevels] >= levels[numLevels - 1])) {
+							printf("Level ratios must lie in (0, 1] and strictly decrease, %s does not.\n", token);
+							usage(argv[0]);
+							return 1;
+						}
+						numLevels++;
+					}
+					continue;
+				}
+				case 'c':
+					i++;
+					if(!strcmp(argv[i], "simple")) cost = simpleCost;
+					else if(!strcmp(argv[i], "melax")) cost = melaxCost;
+					else if(!strcmp(argv[i], "garland")) cost = garlandCost;
+					else {
+						printf("Unknown cost function %s.\n", argv[i]);
+						return 1;
+					}
+					continue;
+				default: break;
+			}
+		}
+		if(!strcmp(argv[i], "-n")) useMeshCache = 0;
+		else if(!strcmp(argv[i], "-p")) rounds = 1;
+		else if(!strcmp(argv[i], "-q")) useQuadrics = 1;
+		else if(input == NULL) input = argv[i];
+		else if(output == NULL) output = argv[i];
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(meshThreads < 1) meshThreads = 1;
+	if(input == NULL || output == NULL) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(budget > 0.0) {
+		if(numLevels > 0 || targetEdges >= 0 || maxCost < INFINITY) {
+			printf("Out of core simplification only supports -f and -r targets.\n");
+			return 1;
+		}
+		start = getSeconds();
+		initFaces = simplifyOutOfCore(input, output, targetFaces, ratio, (size_t)(budget * 1024 * 1024), cost, rounds);
+		printf("Reduced to %d polys out of core in %.3f s.\n", initFaces, getSeconds() - start);
+		return 0;
+	}
+
+	/* The heap is built once below, after clustering and reordering */
+	deferHeap = 1;
+	start = getSeconds();
+	mesh = readMeshFile(input, dimensions);
+	loadTime = getSeconds() - start;
+	initFaces = mesh->numFaces;
+	initEdges = mesh->numEdges;
+
+	if(clusterFaces >= 0) {
+		start = getSeconds();
+		clustered = clusterMesh(mesh, clusterFaces, useQuadrics, dimensions);
+		clusterTime = getSeconds() - start;
+	}
+	if(reorderEvery >= 0) {
+		start = getSeconds();
+		reorderMesh(mesh, dimensions);
+		reorderTime = getSeconds() - start;
+	}
+
+	start = getSeconds();
+	changeCostFunc(mesh, cost);
+	heapTime = getSeconds() - start;
+
+	if(targetFaces < 0 && targetEdges < 0 && numLevels == 0) targetFaces = ratio * initFaces;
+	if(targetFaces < 0) targetFaces = 0;
+	if(targetEdges < 0) targetEdges = 0;
+	targetEdges = MAX(6, targetEdges);
+
+	limits.targetFaces = targetFaces;
+	limits.targetEdges = targetEdges;
+	limits.maxCost = maxCost;
+	limits.budget = 0;
+	limits.rounds = rounds;
+
+	start = getSeconds();
+	if(numLevels > 0) {
+		/* One reduction, capturing each level as its target is crossed */
+		lods = initLodExport(mesh);
+		for(i = 0; i < numLevels; i++) {
+			limits.targetFaces = MAX(targetFaces, levels[i] * initFaces);
+			collapses += reduceReordering(mesh, &limits, reorderEvery, dimensions);
+			captureLod(lods, mesh);
+		}
+	}
+	else collapses = reduceReordering(mesh, &limits, reorderEvery, dimensions);
+	reduceTime = getSeconds() - start;
+
+	start = getSeconds();
+	if(lods != NULL) {
+		if(!writeLodExport(lods, output)) {
+			printf("Could not write file %s.\n", output);
+			return 2;
+		}
+		for(i = 0; i < lods->numLevels; i++) printf("level %d: %d faces\n", i, lods->numFaces[i]);
+		printf("%d shared vertices\n", lods->numEntries);
+		destroyLodExport(lods);
+	}
+	else {
+		f = fopen(output, "w");
+		if(f == NULL) {
+			printf("Could not open file %s for writing.\n", output);
+			return 2;
+		}
+		printMesh(mesh, f);
+		fclose(f);
+	}
+	writeTime = getSeconds() - start;
+
+	printf("Reduced from %d to %d edges, %d to %d polys.\n", initEdges, mesh->numEdges, initFaces, mesh->numFaces);
+	printf("load    %10.3f s\n", loadTime);
+	if(clusterFaces >= 0) printf("cluster %10.3f s  %d collapses, %d polys left\n", clusterTime, clustered, initFaces - 2 * clustered);
+	if(reorderEvery >= 0) printf("reorder %10.3f s\n", reorderTime);
+	printf("heap    %10.3f s\n", heapTime);
+	printf("reduce  %10.3f s  %d collapses, %.0f collapses/s\n", reduceTime, collapses,
+		reduceTime > 0.0 ? collapses/reduceTime : 0.0);
+	printf("write   %10.3f s\n", writeTime);
+	printf("rekeyed %lu edges, skipped %lu duplicate evaluations\n", mesh->rekeyed, mesh->rekeySkipped);
+
+	destroyMesh(mesh);
+	return 0;
+}
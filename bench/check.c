@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <limits.h>
+#include "mesh.h"
+#include "meshio.h"
+#include "meshcache.h"
+#include "progressive.h"
+#include "reorder.h"
+
+/**
+* Checks of the mesh library that need more than the batch command line, run by
+* bench/check.sh. Each check loads the given mesh without a cache, prints what
+* does not hold and exits with status 1 if anything failed.
+*/
+
+int failures = 0;
+
+void fail(const char *check, const char *what) {
+	printf("%s: %s\n", check, what);
+	failures++;
+}
+
+/**
+* Determine if every element of m is in its slot and the half edge links are
+* consistent. Isolated vertices are allowed to have no edge.
+*/
+int linksValid(Mesh *m) {
+	int i;
+	for(i = 0; i < m->numEdges; i++) {
+		Edge *e = m->edges[i];
+		if(e->index != i || e->next->prev != e || e->prev->next != e || e->next->next->next != e) return 0;
+		if(e->next->face != e->face || e->face->index < 0 || e->face->index >= m->numFaces || m->faces[e->face->index] != e->face) return 0;
+		if(e->vert->index < 0 || e->vert->index >= m->numVertices || m->verts[e->vert->index] != e->vert) return 0;
+		if(e->pair != NULL && (e->pair->pair != e || e->pair->vert != e->prev->vert)) return 0;
+	}
+	for(i = 0; i < m->numVertices; i++) {
+		Vertex *v = m->verts[i];
+		if(v->index != i || (v->edge != NULL && v->edge->vert != v)) return 0;
+	}
+	for(i = 0; i < m->numFaces; i++) {
+		Face *f = m->faces[i];
+		if(f->index != i || f->edge->face != f) return 0;
+	}
+	return 1;
+}
+
+int compareTriangles(const void *a, const void *b) {
+	return memcmp(a, b, 9 * sizeof(float));
+}
+
+/**
+* The corner positions of every face of m, each face starting at its smallest
+* corner and the faces sorted, so that meshes holding the same triangles give
+* the same array whatever their storage order.
+*/
+float *triangles(Mesh *m) {
+	float *result = (float*)malloc(9 * (size_t)m->numFaces * sizeof(float) + 1);
+	int i, j;
+	for(i = 0; i < m->numFaces; i++) {
+		Edge *first = m->faces[i]->edge, *e = first;
+		float *t = result + 9 * i;
+		for(j = 0; j < 3; j++) {
+			if(memcmp(&e->vert->x, &first->vert->x, 3 * sizeof(float)) < 0) first = e;
+			e = e->next;
+		}
+		for(j = 0; j < 3; j++) {
+			t[3 * j] = first->vert->x;
+			t[3 * j + 1] = first->vert->y;
+			t[3 * j + 2] = first->vert->z;
+			first = first->next;
+		}
+	}
+	qsort(result, m->numFaces, 9 * sizeof(float), compareTriangles);
+	return result;
+}
+
+/**
+* Determine if m holds exactly the triangles of the array made by triangles.
+*/
+int sameTriangles(Mesh *m, float *expected, int numFaces) {
+	float *actual;
+	int same;
+	if(m->numFaces != numFaces) return 0;
+	actual = triangles(m);
+	same = !memcmp(actual, expected, 9 * (size_t)numFaces * sizeof(float));
+	free(actual);
+	return same;
+}
+
+int comparePositions(const void *a, const void *b) {
+	return memcmp(a, b, 3 * sizeof(float));
+}
+
+/**
+* The positions of the vertices of m sorted, and the number of them without
+* an edge in *isolated.
+*/
+float *positions(Mesh *m, int *isolated) {
+	float *result = (float*)malloc(3 * (size_t)m->numVertices * sizeof(float) + 1);
+	int i;
+	*isolated = 0;
+	for(i = 0; i < m->numVertices; i++) {
+		result[3 * i] = m->verts[i]->x;
+		result[3 * i + 1] = m->verts[i]->y;
+		result[3 * i + 2] = m->verts[i]->z;
+		if(m->verts[i]->edge == NULL) (*isolated)++;
+	}
+	qsort(result, m->numVertices, 3 * sizeof(float), comparePositions);
+	return result;
+}
+
+/**
+* Reorder the mesh and require the same triangles and vertices, isolated ones
+* included, and consistent links. Then reduce it, reordering again halfway,
+* and require the isolated vertices to survive untouched.
+*/
+void checkReorder(char *fileName) {
+	float dimensions[6];
+	Mesh *m = readMeshFile(fileName, dimensions);
+	int initFaces = m->numFaces, initVertices = m->numVertices, isolated, reordered;
+	float *initial = triangles(m), *verts = positions(m, &isolated), *after;
+	reorderMesh(m, dimensions);
+	if(!linksValid(m)) fail("reorder", "reordered mesh is inconsistent");
+	if(!sameTriangles(m, initial, initFaces)) fail("reorder", "reordering changed the triangles");
+	after = positions(m, &reordered);
+	if(m->numVertices != initVertices || memcmp(after, verts, 3 * (size_t)initVertices * sizeof(float))) fail("reorder", "reordering changed the vertices");
+	if(reordered != isolated) fail("reorder", "reordering changed the isolated vertices");
+	free(after);
+	reduceTo(m, initFaces/2, 0, 0);
+	reorderMesh(m, dimensions);
+	reduceTo(m, initFaces/10, 0, 0);
+	if(!linksValid(m)) fail("reorder", "mesh reduced after reordering is inconsistent");
+	after = positions(m, &reordered);
+	if(reordered != isolated) fail("reorder", "reduction after reordering lost isolated vertices");
+	free(after);
+	free(initial);
+	free(verts);
+	destroyMesh(m);
+}
+
+/**
+* Reduce the mesh once as loaded and once reordered after loading and halfway,
+* and require the same triangles. Storage order only breaks ties between equal
+* costs, so the mesh should have none, like a noisy torus.
+*/
+void checkReduceReordered(char *fileName) {
+	float dimensions[6];
+	Mesh *m = readMeshFile(fileName, dimensions), *reordered = readMeshFile(fileName, dimensions);
+	int targetFaces = m->numFaces/10;
+	float *expected;
+	changeCostFunc(m, garlandCost);
+	reduceTo(m, targetFaces, 0, 0);
+	expected = triangles(m);
+	reorderMesh(reordered, dimensions);
+	changeCostFunc(reordered, garlandCost);
+	reduceTo(reordered, reordered->numFaces/2, 0, 0);
+	reorderMesh(reordered, dimensions);
+	reduceTo(reordered, targetFaces, 0, 0);
+	if(!sameTriangles(reordered, expected, m->numFaces)) fail("reduce-reordered", "reordering changed the reduced triangles");
+	free(expected);
+	destroyMesh(m);
+	destroyMesh(reordered);
+}
+
+/**
+* The Euler characteristic of m, or INT_MAX unless it is a closed manifold
+* with consistent links and every vertex used by a face.
+*/
+int closedEuler(Mesh *m) {
+	int i, ringEdges = 0;
+	if(!linksValid(m)) return INT_MAX;
+	for(i = 0; i < m->numEdges; i++) {
+		if(m->edges[i]->pair == NULL) return INT_MAX;
+	}
+	/* The edges into the vertices of a manifold are their rings, each walked once */
+	for(i = 0; i < m->numVertices; i++) {
+		Edge *edge = m->verts[i]->edge;
+		if(edge == NULL) return INT_MAX;
+		do {
+			ringEdges++;
+			edge = edge->pair->prev;
+		} while(edge != m->verts[i]->edge && ringEdges <= m->numEdges);
+	}
+	if(ringEdges != m->numEdges) return INT_MAX;
+	return m->numVertices - m->numEdges/2 + m->numFaces;
+}
+
+/**
+* Require the mesh to be a closed manifold, with the topology of like if given.
+*/
+void checkClosed(char *fileName, char *like) {
+	float dimensions[6];
+	Mesh *m = readMeshFile(fileName, dimensions), *reference;
+	int euler = closedEuler(m);
+	if(euler == INT_MAX) fail("closed", "mesh is not a closed manifold");
+	else if(like != NULL) {
+		reference = readMeshFile(like, dimensions);
+		if(closedEuler(reference) != euler) fail("closed", "mesh has another Euler characteristic");
+		destroyMesh(reference);
+	}
+	destroyMesh(m);
+}
+
+/**
+* Pack the mesh as loaded and after reduction, unpack it again and require the
+* same triangles, vertices and consistent links.
+*/
+void checkPack(char *fileName) {
+	float dimensions[6];
+	Mesh *m = readMeshFile(fileName, dimensions), *unpacked;
+	CompactMesh *c;
+	float *expected, *verts, *after;
+	int pass, isolated, unpackedIsolated;
+	for(pass = 0; pass <= 1; pass++) {
+		if(pass) reduceTo(m, m->numFaces/4, 0, 0);
+		expected = triangles(m);
+		verts = positions(m, &isolated);
+		c = packMesh(m);
+		unpacked = unpackMesh(c);
+		destroyCompactMesh(c);
+		if(!linksValid(unpacked)) fail("pack", "unpacked mesh is inconsistent");
+		if(!sameTriangles(unpacked, expected, m->numFaces)) fail("pack", "packing changed the triangles");
+		after = positions(unpacked, &unpackedIsolated);
+		if(unpacked->numVertices != m->numVertices || unpackedIsolated != isolated ||
+				memcmp(after, verts, 3 * (size_t)m->numVertices * sizeof(float))) fail("pack", "packing changed the vertices");
+		free(after);
+		free(verts);
+		free(expected);
+		destroyMesh(unpacked);
+	}
+	destroyMesh(m);
+}
+
+/**
+* The highest cost of the recorded collapses of m, evaluated by undoing them one
+* by one so each is seen in the mesh it was taken from, after which they are redone.
+*/
+float recordedMaxCost(Mesh *m) {
+	float cost, maxCost = -INFINITY;
+	int applied = m->recorder->current;
+	while(undoCollapse(m)) {
+		cost = (*m->heap->func)(m->recorder->records[m->recorder->current].edge);
+		if(cost > maxCost) maxCost = cost;
+	}
+	while(m->recorder->current < applied) redoCollapse(m);
+	return maxCost;
+}
+
+/**
+* Check every stop condition of reduceUntil in serial and parallel rounds. The
+* target is met without overshooting by more than a collapse, no edge costing
+* more than maxCost is collapsed, reducing in slices of a tiny time budget gives
+* what one call gives, and an unreachable target ends with nothing left to do.
+*/
+void checkUntil(char *fileName) {
+	float dimensions[6];
+	Mesh *m = readMeshFile(fileName, dimensions);
+	ReduceLimits limits;
+	int initFaces = m->numFaces, rounds, reason, done, slices;
+	float medianCost, *expected = NULL;
+	destroyMesh(m);
+
+	/* Stop halfway in cost, at the cost of the edge the serial reduction would take next at half the faces */
+	m = readMeshFile(fileName, dimensions);
+	reduceTo(m, initFaces/2, 0, 0);
+	medianCost = heapMinCost(m->heap);
+	destroyMesh(m);
+
+	for(rounds = 0; rounds <= 1; rounds++) {
+		limits.targetFaces = initFaces/10;
+		limits.targetEdges = 0;
+		limits.maxCost = INFINITY;
+		limits.budget = 0;
+		limits.rounds = rounds;
+		m = readMeshFile(fileName, dimensions);
+		reason = reduceUntil(m, &limits, &done);
+		if(reason != REDUCE_TARGET || m->numFaces > limits.targetFaces || m->numFaces < limits.targetFaces - 2 ||
+				done != (initFaces - m->numFaces)/2) fail("until", "face target missed");
+		if(!linksValid(m)) fail("until", "mesh reduced to a target is inconsistent");
+		if(!rounds) expected = triangles(m);
+		destroyMesh(m);
+
+		limits.targetFaces = 0;
+		limits.maxCost = medianCost;
+		m = readMeshFile(fileName, dimensions);
+		startRecording(m);
+		reason = reduceUntil(m, &limits, &done);
+		if(reason != REDUCE_COST || heapMinCost(m->heap) <= medianCost) fail("until", "stopped before the cost limit");
+		if(recordedMaxCost(m) > medianCost) fail("until", "collapsed an edge above the cost limit");
+		destroyMesh(m);
+
+		limits.targetFaces = initFaces/10;
+		limits.maxCost = INFINITY;
+		limits.budget = 1;
+		m = readMeshFile(fileName, dimensions);
+		slices = 0;
+		do {
+			reason = reduceUntil(m, &limits, &done);
+			if(done == 0) break;
+			slices++;
+		} while(reason == REDUCE_TIME);
+		if(reason != REDUCE_TARGET || slices < 2 || m->numFaces > limits.targetFaces) fail("until", "time budget not met in slices");
+		if(!rounds && !sameTriangles(m, expected, m->numFaces)) fail("until", "reducing in slices changed the result");
+		destroyMesh(m);
+
+		limits.targetFaces = 0;
+		limits.budget = 0;
+		m = readMeshFile(fileName, dimensions);
+		reason = reduceUntil(m, &limits, &done);
+		if(reason != REDUCE_STUCK || reduceUntil(m, &limits, &done) != REDUCE_STUCK || done != 0) fail("until", "unreachable target does not end stuck");
+		if(!linksValid(m)) fail("until", "fully reduced mesh is inconsistent");
+		destroyMesh(m);
+	}
+	free(expected);
+}
+
+/**
+* Determine if the vertices of m have the quadrics in the array, by index.
+*/
+int sameQuadrics(Mesh *m, double *expected) {
+	int i;
+	for(i = 0; i < m->numVertices; i++) {
+		if(memcmp(m->verts[i]->quadric, expected + 10 * i, 10 * sizeof(double))) return 0;
+	}
+	return 1;
+}
+
+/**
+* Reduce with recording in serial and parallel rounds, then undo back to the
+* loaded mesh, redo to the reduced one and take a different path from halfway.
+* Every level visited must hold exactly the triangles it held before, and the
+* loaded mesh its quadrics, so reducing it again takes the same collapses.
+*/
+void checkUndo(char *fileName) {
+	float dimensions[6];
+	Mesh *m = readMeshFile(fileName, dimensions);
+	int initFaces = m->numFaces, reducedFaces, rounds, i;
+	float *initial = triangles(m), *reduced;
+	double *quadrics = (double*)malloc(10 * (size_t)m->numVertices * sizeof(double) + 1);
+	for(i = 0; i < m->numVertices; i++) memcpy(quadrics + 10 * i, m->verts[i]->quadric, 10 * sizeof(double));
+	startRecording(m);
+	for(rounds = 0; rounds <= 1; rounds++) {
+		changeCostFunc(m, garlandCost);
+		reduceTo(m, initFaces/10, 0, rounds);
+		reducedFaces = m->numFaces;
+		reduced = triangles(m);
+		if(!linksValid(m)) fail("undo", "reduced mesh is inconsistent");
+		if(seekFaces(m, INT_MAX) != initFaces || !sameTriangles(m, initial, initFaces)) fail("undo", "undoing every collapse does not give the loaded mesh");
+		if(!sameQuadrics(m, quadrics)) fail("undo", "undoing every collapse does not restore the quadrics");
+		if(!linksValid(m)) fail("undo", "restored mesh is inconsistent");
+		if(seekFaces(m, reducedFaces) != reducedFaces || !sameTriangles(m, reduced, reducedFaces)) fail("undo", "redoing every collapse does not give the reduced mesh");
+		seekFaces(m, INT_MAX);
+		reduceTo(m, initFaces/10, 0, rounds);
+		if(!sameTriangles(m, reduced, reducedFaces)) fail("undo", "reducing the restored mesh again takes other collapses");
+		free(reduced);
+		/* Branch off halfway, which drops the collapses after it */
+		seekFaces(m, initFaces/2);
+		changeCostFunc(m, melaxCost);
+		reduceTo(m, initFaces/5, 0, rounds);
+		if(!linksValid(m)) fail("undo", "mesh reduced after undoing is inconsistent");
+		if(seekFaces(m, INT_MAX) != initFaces || !sameTriangles(m, initial, initFaces)) fail("undo", "undoing a branched history does not give the loaded mesh");
+		if(!sameQuadrics(m, quadrics)) fail("undo", "undoing a branched history does not restore the quadrics");
+	}
+	free(quadrics);
+	free(initial);
+	destroyMesh(m);
+}
+
+int main(int argc, char **argv) {
+	useMeshCache = 0;
+	if(argc < 3 || argc > 4 || (argc == 4 && strcmp(argv[1], "closed"))) {
+		printf("Usage: %s pack|undo|reorder|reduce-reordered|until mesh.off\n", argv[0]);
+		printf("       %s closed mesh.off [like.off]\n", argv[0]);
+		return 2;
+	}
+	if(!strcmp(argv[1], "pack")) checkPack(argv[2]);
+	else if(!strcmp(argv[1], "undo")) checkUndo(argv[2]);
+	else if(!strcmp(argv[1], "reorder")) checkReorder(argv[2]);
+	else if(!strcmp(argv[1], "reduce-reordered")) checkReduceReordered(argv[2]);
+	else if(!strcmp(argv[1], "until")) checkUntil(argv[2]);
+	else if(!strcmp(argv[1], "closed")) checkClosed(argv[2], argc == 4 ? argv[3] : NULL);
+	else {
+		printf("Unknown check %s.\n", argv[1]);
+		return 2;
+	}
+	return failures > 0;
+}
@@ -0,0 +1,111 @@
+#!/bin/sh
+# Check batch and, through bench/check, the mesh library against what their
+# features promise on small generated meshes.
+# Prints one line per case and exits with status 1 if any of them failed.
+#
+# Usage: bench/check.sh
+
+DIR=bench/meshes/check
+failed=0
+
+# Report the case named $2 as passed if $1, the status of its commands, is 0
+result() {
+	if [ "$1" -eq 0 ]; then
+		echo "ok      $2"
+	else
+		echo "FAILED  $2"
+		failed=$((failed + 1))
+	fi
+}
+
+# Overwrite the last four bytes of file $1 with an index out of every range
+corrupt() {
+	size=$(wc -c < "$1")
+	printf '\377\377\377\377' | dd of="$1" bs=1 seek=$((size - 4)) conv=notrunc 2> /dev/null
+}
+
+# Cut the last eight bytes off file $1
+shorten() {
+	size=$(wc -c < "$1")
+	dd if="$1" of="$1.tmp" bs=$((size - 8)) count=1 2> /dev/null && mv "$1.tmp" "$1"
+}
+
+mkdir -p "$DIR" || exit 1
+./meshgen icosphere 4 "$DIR/sphere.off" > /dev/null || exit 1
+./meshgen torus 20000 "$DIR/torus.off" 0.1 > /dev/null || exit 1
+rm -f "$DIR"/*.mbin
+# A cube with a vertex no face uses
+printf 'OFF\n9 12 0\n0 0 0\n1 0 0\n1 1 0\n0 1 0\n0 0 1\n1 0 1\n1 1 1\n0 1 1\n5 5 5\n' > "$DIR/isolated.off"
+printf '3 0 2 1\n3 0 3 2\n3 4 5 6\n3 4 6 7\n3 0 1 5\n3 0 5 4\n3 1 2 6\n3 1 6 5\n3 2 3 7\n3 2 7 6\n3 3 0 4\n3 3 4 7\n' >> "$DIR/isolated.off"
+
+# Reductions of a parsed, a freshly cached and a mapped mesh are identical
+./batch -n -r 0.5 "$DIR/torus.off" "$DIR/parsed.off" > /dev/null &&
+	./batch -r 0.5 "$DIR/torus.off" "$DIR/written.off" > /dev/null &&
+	./batch -r 0.5 "$DIR/torus.off" "$DIR/mapped.off" | grep -q "from cache" &&
+	cmp -s "$DIR/parsed.off" "$DIR/written.off" && cmp -s "$DIR/parsed.off" "$DIR/mapped.off"
+result $? "cache round trip"
+
+# A cache is rebuilt when its source gets another modification time, even an older one
+./batch -n -r 0.5 "$DIR/sphere.off" "$DIR/parsed.off" > /dev/null &&
+	./batch -r 0.5 "$DIR/sphere.off" "$DIR/written.off" > /dev/null &&
+	touch -t 200001010000 "$DIR/sphere.off" &&
+	! ./batch -r 0.5 "$DIR/sphere.off" "$DIR/mapped.off" | grep -q "from cache" &&
+	./batch -r 0.5 "$DIR/sphere.off" "$DIR/mapped.off" | grep -q "from cache" &&
+	cmp -s "$DIR/parsed.off" "$DIR/mapped.off"
+result $? "cache of a changed source rebuilt"
+
+# Damaged caches are rejected and rebuilt rather than mapped
+corrupt "$DIR/sphere.off.mbin" &&
+	! ./batch -r 0.5 "$DIR/sphere.off" "$DIR/mapped.off" | grep -q "from cache" &&
+	cmp -s "$DIR/parsed.off" "$DIR/mapped.off"
+result $? "corrupt cache rejected"
+shorten "$DIR/sphere.off.mbin" &&
+	! ./batch -r 0.5 "$DIR/sphere.off" "$DIR/mapped.off" | grep -q "from cache" &&
+	cmp -s "$DIR/parsed.off" "$DIR/mapped.off"
+result $? "truncated cache rejected"
+
+# Levels of detail go from finest to coarsest, other orders are rejected
+./batch -n -l 0.9,0.5,0.1 "$DIR/sphere.off" "$DIR/levels.mlod" > /dev/null &&
+	! ./batch -n -l 0.1,0.5 "$DIR/sphere.off" "$DIR/levels.mlod" > /dev/null &&
+	! ./batch -n -l 0.5,0.5 "$DIR/sphere.off" "$DIR/levels.mlod" > /dev/null &&
+	! ./batch -n -l 1.5 "$DIR/sphere.off" "$DIR/levels.mlod" > /dev/null
+result $? "level ratio order"
+
+# Packing into the cache layout and unpacking gives back the same mesh
+./bench/check pack "$DIR/torus.off" > /dev/null &&
+	./bench/check pack "$DIR/isolated.off" > /dev/null
+result $? "pack round trip"
+
+# Undoing and redoing recorded collapses moves exactly between the levels reduced to
+./bench/check undo "$DIR/torus.off" > /dev/null
+result $? "undo and redo round trip"
+
+# Reordering changes storage order only, isolated vertices included
+./bench/check reorder "$DIR/torus.off" > /dev/null &&
+	./bench/check reorder "$DIR/isolated.off" > /dev/null &&
+	./batch -n -o 0 -r 0.5 "$DIR/isolated.off" "$DIR/reordered.off" > /dev/null &&
+	grep -q "^5[.0]* 5[.0]* 5[.0]*$" "$DIR/reordered.off"
+result $? "reorder invariance"
+./bench/check reduce-reordered "$DIR/torus.off" > /dev/null
+result $? "reduction invariant under reordering"
+
+# Out of core reduction reaches the in core face count, with headroom left to the
+# stitched pass, and keeps the surface closed with the topology of the input
+faces=$(./batch -n -r 0.1 "$DIR/torus.off" "$DIR/incore.off" | sed -n 's/^Reduced from .* to \([0-9]*\) polys.*/\1/p')
+./batch -m 2 -r 0.1 "$DIR/torus.off" "$DIR/outofcore.off" > "$DIR/batch.log" &&
+	stitched=$(sed -n 's/^Stitched \([0-9]*\) faces.*/\1/p' "$DIR/batch.log") &&
+	reduced=$(sed -n 2p "$DIR/outofcore.off" | cut -d' ' -f2) &&
+	[ "$reduced" -le "$faces" ] && [ "$stitched" -gt "$reduced" ] &&
+	./bench/check closed "$DIR/outofcore.off" "$DIR/torus.off" > /dev/null
+result $? "out of core face count"
+
+# reduceUntil honours its face target, cost limit and time budget serially and in rounds
+./bench/check until "$DIR/torus.off" > /dev/null
+result $? "reduceUntil limits"
+
+rm -rf "$DIR"
+if [ "$failed" -gt 0 ]; then
+	echo "$failed checks failed."
+	exit 1
+fi
+echo "All checks passed."
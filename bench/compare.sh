@@ -0,0 +1,32 @@
+#!/bin/sh
+# Compare two result files of bench/run.sh row by row. Prints the ratio of new to
+# baseline time for every phase and exits with status 1 if any reduce time grew
+# by more than BENCH_TOLERANCE (default 0.1, i.e. 10%).
+#
+# Usage: bench/compare.sh baseline.csv results.csv
+
+BASE=${1:-bench/baseline.csv}
+NEW=${2:-bench/results.csv}
+TOLERANCE=${BENCH_TOLERANCE:-0.1}
+
+awk -F, -v tolerance="$TOLERANCE" '
+	FNR == 1 { next }
+	NR == FNR { base[$1 "," $3 "," $4 "," $5] = $0; next }
+	{
+		key = $1 "," $3 "," $4 "," $5
+		if(!(key in base)) { printf "%-40s no baseline\n", key; next }
+		split(base[key], b, ",")
+		line = sprintf("%-40s", key)
+		for(i = 6; i <= 9; i++) line = line sprintf(" %s %5.2fx", name[i], b[i] > 0 ? $i/b[i] : 1)
+		if(b[8] > 0 && $8/b[8] > 1 + tolerance) {
+			line = line "  SLOWER"
+			slower++
+		}
+		print line
+	}
+	BEGIN { name[6] = "load"; name[7] = "heap"; name[8] = "reduce"; name[9] = "write" }
+	END {
+		if(slower) printf "%d reductions slower than the baseline.\n", slower
+		exit slower > 0
+	}
+' "$BASE" "$NEW"
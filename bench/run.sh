@@ -0,0 +1,43 @@
+#!/bin/sh
+# Time batch on generated meshes and write one CSV row per mesh, cost function
+# and reduction ratio. Meshes are generated into bench/meshes on first use.
+#
+# Usage: bench/run.sh results.csv
+#
+# BENCH_MESHES   Space separated specs, icosphere:LEVEL or torus:FACES[:NOISE]
+# BENCH_COSTS    Cost functions to run (default "simple melax garland")
+# BENCH_RATIOS   Face ratios to reduce to (default "0.5 0.1")
+# BENCH_THREADS  Worker threads passed to batch (default 1)
+
+OUT=${1:-bench/results.csv}
+MESHES=${BENCH_MESHES:-"icosphere:6 icosphere:8 torus:1000000:0.1"}
+COSTS=${BENCH_COSTS:-"simple melax garland"}
+RATIOS=${BENCH_RATIOS:-"0.5 0.1"}
+THREADS=${BENCH_THREADS:-1}
+DIR=bench/meshes
+
+mkdir -p "$DIR" || exit 1
+echo "mesh,faces,cost,ratio,threads,load,heap,reduce,write,collapses_per_s" > "$OUT"
+for spec in $MESHES; do
+	name=$(echo "$spec" | tr ':' '_')
+	file="$DIR/$name.off"
+	if [ ! -f "$file" ]; then
+		case "$spec" in
+			icosphere:*) ./meshgen icosphere "$(echo "$spec" | cut -d: -f2)" "$file" || exit 1 ;;
+			torus:*) ./meshgen torus "$(echo "$spec" | cut -d: -f2)" "$file" "$(echo "$spec" | cut -d: -f3)" || exit 1 ;;
+			*) echo "Unknown mesh $spec." ; exit 1 ;;
+		esac
+	fi
+	faces=$(sed -n 2p "$file" | cut -d' ' -f2)
+	for cost in $COSTS; do
+		for ratio in $RATIOS; do
+			./batch -n -t "$THREADS" -c "$cost" -r "$ratio" "$file" "$DIR/out.off" > "$DIR/batch.log" || exit 1
+			awk -v mesh="$name" -v faces="$faces" -v cost="$cost" -v ratio="$ratio" -v threads="$THREADS" '
+				$1 == "load" || $1 == "heap" || $1 == "write" { t[$1] = $2 }
+				$1 == "reduce" { t["reduce"] = $2; rate = $6 }
+				END { printf "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n", mesh, faces, cost, ratio, threads, t["load"], t["heap"], t["reduce"], t["write"], rate }
+			' "$DIR/batch.log" | tee -a "$OUT"
+		done
+	done
+done
+rm -f "$DIR/out.off" "$DIR/batch.log"
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include "cluster.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define CLUSTER_EMPTY UINT64_MAX
+#define CLUSTER_BITS 21 /* Bits per packed cell coordinate */
+
+uint64_t positionKey(ClusterGrid *g, float x, float y, float z) {
+	const float p[3] = {x, y, z};
+	uint64_t key = 0;
+	int i;
+	for(i = 0; i < 3; i++) {
+		double cell = (p[i] - g->origin[i])/g->cellSize;
+		cell = MAX(0.0, MIN(cell, (double)((1 << CLUSTER_BITS) - 1)));
+		key = (key << CLUSTER_BITS) | (uint64_t)cell;
+	}
+	return key;
+}
+
+uint64_t vertexKey(ClusterGrid *g, Vertex *v) {
+	return positionKey(g, v->x, v->y, v->z);
+}
+
+/**
+* Find the cell with the given key, adding an empty one if insert is set.
+* Returns NULL for a missing cell otherwise.
+*/
+ClusterCell *findCell(ClusterGrid *g, uint64_t key, int insert) {
+	uint64_t slot = ((key * 0x9E3779B97F4A7C15ull) >> 17) & g->mask;
+	while(g->keys[slot] != CLUSTER_EMPTY) {
+		if(g->keys[slot] == key) return &g->cells[slot];
+		slot = (slot + 1) & g->mask;
+	}
+	if(!insert) return NULL;
+	g->keys[slot] = key;
+	memset(&g->cells[slot], 0, sizeof(ClusterCell));
+	g->numCells++;
+	return &g->cells[slot];
+}
+
+/**
+* Bin every vertex into a grid of the given cell size, summing the positions and
+* quadrics of each cell. Returns the number of occupied cells.
+*/
+int fillGrid(ClusterGrid *g, Mesh *m, float cellSize) {
+	int i, j;
+	memset(g->keys, 0xFF, (g->mask + 1) * sizeof(uint64_t));
+	g->numCells = 0;
+	g->cellSize = cellSize;
+	for(i = 0; i < m->numVertices; i++) {
+		Vertex *v = m->verts[i];
+		ClusterCell *cell = findCell(g, vertexKey(g, v), 1);
+		cell->sum[0] += v->x;
+		cell->sum[1] += v->y;
+		cell->sum[2] += v->z;
+		for(j = 0; j < 10; j++) cell->quadric[j] += v->quadric[j];
+		cell->count++;
+	}
+	return g->numCells;
+}
+
+/**
+* Collapse edges whose ends share a cell, in up to CLUSTER_PASSES sweeps over the
+* edges, until targetFaces faces remain. Returns the number of collapses.
+*/
+int clusterSweep(ClusterGrid *g, Mesh *m, int targetFaces) {
+	ClusterCell *cell;
+	Vertex *head, *tail, *p;
+	Edge *e;
+	float position[3];
+	int collapses = 0, before, claim, pass, i;
+	uint64_t key;
+	for(pass = 0; pass < CLUSTER_PASSES && m->numFaces > targetFaces; pass++) {
+		before = collapses;
+		/* A collapse moves the last edges into freed slots, so slot i is looked at again */
+		for(i = 0; i < m->numEdges && m->numFaces > targetFaces;) {
+			e = m->edges[i];
+			head = e->vert;
+			tail = e->pair->vert;
+			key = vertexKey(g, head);
+			if(key != vertexKey(g, tail) || !collapsable(e)) {
+				i++;
+				continue;
+			}
+			cell = findCell(g, key, 0);
+			claim = cell->owner == NULL || cell->owner == head || cell->owner == tail;
+			if(claim) memcpy(position, cell->position, sizeof(position));
+			else {
+				position[0] = tail->x;
+				position[1] = tail->y;
+				position[2] = tail->z;
+			}
+			p = contractEdgeTo(e, position);
+			removeContracted(m, e);
+			if(claim) cell->owner = p;
+			collapses++;
+		}
+		if(collapses == before) break;
+	}
+	return collapses;
+}
+
+/**
+* Pre-decimate m by vertex clustering, down to about targetFaces faces. A uniform
+* grid is fitted so that roughly targetFaces/2 of its cells hold vertices, then
+* edges whose ends share a cell are collapsed in a few linear sweeps. Every
+* collapse passes the link condition, so the result stays manifold where plain
+* clustering would not, and a cell left with several vertices keeps them. If
+* that leaves too many faces the survivors are clustered again on a coarser grid.
+* The first collapse in a cell moves its vertex to the representative of the
+* cell, the average of its vertices or, if useQuadrics is set, the minimizer of
+* their summed quadric when that lies in the cell.
+*
+* Heap keys are left stale, rebuild them with changeCostFunc before reducing
+* further. Must not be used while recording. Returns the number of collapses.
+*/
+int clusterMesh(Mesh *m, int targetFaces, int useQuadrics, const float dimensions[6]) {
+	ClusterGrid g;
+	ClusterCell *cell;
+	float extent = 0.0f;
+	double res = CLUSTER_START_RES;
+	int targetVerts = MAX(4, targetFaces/2), collapses = 0, level, i;
+	uint64_t slot;
+
+	if(m->numFaces <= targetFaces) return 0;
+	for(i = 0; i < 3; i++) {
+		g.origin[i] = dimensions[2 * i];
+		extent = MAX(extent, dimensions[2 * i + 1] - dimensions[2 * i]);
+	}
+	if(!(extent > 0.0f)) return 0;
+	for(g.mask = 1; g.mask < 2 * (uint64_t)m->numVertices; g.mask *= 2);
+	g.keys = (uint64_t*)malloc(g.mask * sizeof(uint64_t));
+	g.cells = (ClusterCell*)malloc(g.mask * sizeof(ClusterCell));
+	g.mask -= 1;
+
+	/* Occupied cells of a surface grow with the square of the resolution */
+	for(i = 0; i < CLUSTER_FITS; i++) {
+		int occupied = fillGrid(&g, m, extent/res);
+		res = MAX(1.0, MIN(res * sqrt((double)targetVerts/occupied), CLUSTER_MAX_RES));
+	}
+	for(level = 0; level < CLUSTER_LEVELS && m->numFaces > targetFaces; level++) {
+		/* Collapses left blocked by the link condition are retried on a coarser grid */
+		if(level > 0) res = MAX(1.0, res * sqrt((double)targetFaces/m->numFaces));
+		fillGrid(&g, m, extent/res);
+		for(slot = 0; slot <= g.mask; slot++) {
+			if(g.keys[slot] == CLUSTER_EMPTY) continue;
+			cell = &g.cells[slot];
+			if(useQuadrics && quadricMinimum(cell->quadric, cell->position) &&
+				positionKey(&g, cell->position[0], cell->position[1], cell->position[2]) == g.keys[slot]) continue;
+			for(i = 0; i < 3; i++) cell->position[i] = cell->sum[i]/cell->count;
+		}
+		collapses += clusterSweep(&g, m, targetFaces);
+	}
+	refreshStaleNormals(m);
+	free(g.keys);
+	free(g.cells);
+	return collapses;
+}
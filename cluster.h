@@ -0,0 +1,41 @@
+#ifndef __CLUSTER_H__
+#define __CLUSTER_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "mesh.h"
+
+#define CLUSTER_START_RES 64 /* Cells along the longest side of the first grid tried */
+#define CLUSTER_MAX_RES 1048576
+#define CLUSTER_FITS 3 /* Grid resolutions tried to match the occupied cells to the target */
+#define CLUSTER_LEVELS 4 /* Grids tried, each coarser than the last, while too many faces remain */
+#define CLUSTER_PASSES 4 /* Sweeps over the edges, later ones pick up collapses unblocked by earlier ones */
+
+/**
+* A grid cell holding at least one vertex, with the representative its
+* vertices are merged at.
+*/
+typedef struct _clustercell {
+	double sum[3]; /* Sum of the positions of the vertices in the cell */
+	double quadric[10]; /* Sum of their error quadrics */
+	int count;
+	float position[3]; /* Representative */
+	Vertex *owner; /* Vertex moved to the representative, NULL until one is */
+} ClusterCell;
+
+/**
+* Uniform grid of cubic cells over the bounding box, storing only the occupied
+* cells in an open addressing table.
+*/
+typedef struct _clustergrid {
+	float origin[3];
+	float cellSize;
+	uint64_t mask;
+	uint64_t *keys; /* Packed cell coordinates, CLUSTER_EMPTY in free slots */
+	ClusterCell *cells;
+	int numCells;
+} ClusterGrid;
+
+int clusterMesh(Mesh *m, int targetFaces, int useQuadrics, const float dimensions[6]);
+
+#endif
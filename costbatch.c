@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "costbatch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define COST_X86
+#include <immintrin.h>
+#endif
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+int detectedSimd = SIMD_SCALAR;
+pthread_once_t simdDetection = PTHREAD_ONCE_INIT;
+
+void detectSimd() {
+	const char *forced = getenv("MESH_SIMD");
+	int level = SIMD_SCALAR;
+#ifdef COST_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) level = SIMD_AVX2;
+	else if(__builtin_cpu_supports("sse2")) level = SIMD_SSE;
+#endif
+	if(forced != NULL && !strcmp(forced, "scalar")) level = SIMD_SCALAR;
+	else if(forced != NULL && !strcmp(forced, "sse") && level > SIMD_SSE) level = SIMD_SSE;
+	detectedSimd = level;
+}
+
+/**
+* Instruction set used by the kernels, detected once by whichever thread asks
+* first, so the workers evaluating costs may all call it.
+*/
+int simdLevel() {
+	pthread_once(&simdDetection, detectSimd);
+	return detectedSimd;
+}
+
+/**
+* Evaluate func for every edge, with a batch kernel when there is one.
+*/
+void evaluateCosts(float (*func)(Edge*), Edge **edges, int count, float *costs) {
+	int i;
+	if(func == simpleCost) simpleCostBatch(edges, count, costs);
+	else if(func == garlandCost) garlandCostBatch(edges, count, costs);
+	else {
+		for(i = 0; i < count; i++) costs[i] = (*func)(edges[i]);
+	}
+}
+
+#ifdef COST_X86
+/* Lanes are the endpoint positions, head x, y, z then tail x, y, z */
+__attribute__((target("avx2")))
+int simpleLanesAvx2(float lanes[6][COST_BLOCK], int n, float *costs) {
+	int i;
+	for(i = 0; i + 8 <= n; i += 8) {
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(lanes[0] + i), _mm256_loadu_ps(lanes[3] + i));
+		__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(lanes[1] + i), _mm256_loadu_ps(lanes[4] + i));
+		__m256 dz = _mm256_sub_ps(_mm256_loadu_ps(lanes[2] + i), _mm256_loadu_ps(lanes[5] + i));
+		__m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		_mm256_storeu_ps(costs + i, _mm256_sqrt_ps(len2));
+	}
+	return i;
+}
+
+__attribute__((target("sse2")))
+int simpleLanesSse(float lanes[6][COST_BLOCK], int n, float *costs) {
+	int i;
+	for(i = 0; i + 4 <= n; i += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(lanes[0] + i), _mm_loadu_ps(lanes[3] + i));
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(lanes[1] + i), _mm_loadu_ps(lanes[4] + i));
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(lanes[2] + i), _mm_loadu_ps(lanes[5] + i));
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		_mm_storeu_ps(costs + i, _mm_sqrt_ps(len2));
+	}
+	return i;
+}
+
+/**
+* The well conditioned branch of garlandPlacement on four summed quadrics at
+* once. Lanes whose system is ill conditioned are flagged 0 in solved and their
+* costs must be computed by the scalar path.
+*/
+__attribute__((target("avx2")))
+int garlandLanesAvx2(double q[10][COST_BLOCK], int n, float *costs, unsigned char *solved) {
+	const __m256d sign = _mm256_set1_pd(-0.0), two = _mm256_set1_pd(2.0), zero = _mm256_setzero_pd();
+	const __m256d tiny = _mm256_set1_pd(1e-10);
+	int i, mask;
+	for(i = 0; i + 4 <= n; i += 4) {
+		__m256d q0 = _mm256_loadu_pd(q[0] + i), q1 = _mm256_loadu_pd(q[1] + i), q2 = _mm256_loadu_pd(q[2] + i);
+		__m256d q3 = _mm256_loadu_pd(q[3] + i), q4 = _mm256_loadu_pd(q[4] + i), q5 = _mm256_loadu_pd(q[5] + i);
+		__m256d q6 = _mm256_loadu_pd(q[6] + i), q7 = _mm256_loadu_pd(q[7] + i), q8 = _mm256_loadu_pd(q[8] + i);
+		__m256d q9 = _mm256_loadu_pd(q[9] + i);
+		__m256d a = _mm256_sub_pd(_mm256_mul_pd(q4, q7), _mm256_mul_pd(q5, q5));
+		__m256d b = _mm256_sub_pd(_mm256_mul_pd(q2, q5), _mm256_mul_pd(q1, q7));
+		__m256d c = _mm256_sub_pd(_mm256_mul_pd(q1, q5), _mm256_mul_pd(q2, q4));
+		__m256d det = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(q0, a), _mm256_mul_pd(q1, b)), _mm256_mul_pd(q2, c));
+		__m256d scale = _mm256_max_pd(_mm256_andnot_pd(sign, q0),
+			_mm256_max_pd(_mm256_andnot_pd(sign, q4), _mm256_andnot_pd(sign, q7)));
+		__m256d bound = _mm256_mul_pd(_mm256_mul_pd(_mm256_mul_pd(tiny, scale), scale), scale);
+		__m256d d = _mm256_sub_pd(_mm256_mul_pd(q0, q7), _mm256_mul_pd(q2, q2));
+		__m256d f = _mm256_sub_pd(_mm256_mul_pd(q1, q2), _mm256_mul_pd(q0, q5));
+		__m256d g = _mm256_sub_pd(_mm256_mul_pd(q0, q4), _mm256_mul_pd(q1, q1));
+		__m256d x = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a, q3), _mm256_mul_pd(b, q6)), _mm256_mul_pd(c, q8));
+		__m256d y = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(b, q3), _mm256_mul_pd(d, q6)), _mm256_mul_pd(f, q8));
+		__m256d z = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c, q3), _mm256_mul_pd(f, q6)), _mm256_mul_pd(g, q8));
+		__m256d error;
+		mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, det), bound, _CMP_GT_OQ));
+		/* The position is rounded to float as garlandPlacement stores it */
+		x = _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_div_pd(_mm256_xor_pd(x, sign), det)));
+		y = _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_div_pd(_mm256_xor_pd(y, sign), det)));
+		z = _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_div_pd(_mm256_xor_pd(z, sign), det)));
+		/* quadricError(q, x, y, z) */
+		error = _mm256_mul_pd(x, _mm256_add_pd(_mm256_mul_pd(q0, x), _mm256_mul_pd(two,
+			_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(q1, y), _mm256_mul_pd(q2, z)), q3))));
+		error = _mm256_add_pd(error, _mm256_mul_pd(y, _mm256_add_pd(_mm256_mul_pd(q4, y), _mm256_mul_pd(two,
+			_mm256_add_pd(_mm256_mul_pd(q5, z), q6)))));
+		error = _mm256_add_pd(error, _mm256_mul_pd(z, _mm256_add_pd(_mm256_mul_pd(q7, z), _mm256_mul_pd(two, q8))));
+		error = _mm256_max_pd(_mm256_add_pd(error, q9), zero);
+		_mm_storeu_ps(costs + i, _mm256_cvtpd_ps(error));
+		solved[i] = mask & 1;
+		solved[i + 1] = (mask >> 1) & 1;
+		solved[i + 2] = (mask >> 2) & 1;
+		solved[i + 3] = (mask >> 3) & 1;
+	}
+	return i;
+}
+
+__attribute__((target("sse2")))
+int garlandLanesSse(double q[10][COST_BLOCK], int n, float *costs, unsigned char *solved) {
+	const __m128d sign = _mm_set1_pd(-0.0), two = _mm_set1_pd(2.0), zero = _mm_setzero_pd();
+	const __m128d tiny = _mm_set1_pd(1e-10);
+	int i, mask;
+	for(i = 0; i + 2 <= n; i += 2) {
+		__m128d q0 = _mm_loadu_pd(q[0] + i), q1 = _mm_loadu_pd(q[1] + i), q2 = _mm_loadu_pd(q[2] + i);
+		__m128d q3 = _mm_loadu_pd(q[3] + i), q4 = _mm_loadu_pd(q[4] + i), q5 = _mm_loadu_pd(q[5] + i);
+		__m128d q6 = _mm_loadu_pd(q[6] + i), q7 = _mm_loadu_pd(q[7] + i), q8 = _mm_loadu_pd(q[8] + i);
+		__m128d q9 = _mm_loadu_pd(q[9] + i);
+		__m128d a = _mm_sub_pd(_mm_mul_pd(q4, q7), _mm_mul_pd(q5, q5));
+		__m128d b = _mm_sub_pd(_mm_mul_pd(q2, q5), _mm_mul_pd(q1, q7));
+		__m128d c = _mm_sub_pd(_mm_mul_pd(q1, q5), _mm_mul_pd(q2, q4));
+		__m128d det = _mm_add_pd(_mm_add_pd(_mm_mul_pd(q0, a), _mm_mul_pd(q1, b)), _mm_mul_pd(q2, c));
+		__m128d scale = _mm_max_pd(_mm_andnot_pd(sign, q0), _mm_max_pd(_mm_andnot_pd(sign, q4), _mm_andnot_pd(sign, q7)));
+		__m128d bound = _mm_mul_pd(_mm_mul_pd(_mm_mul_pd(tiny, scale), scale), scale);
+		__m128d d = _mm_sub_pd(_mm_mul_pd(q0, q7), _mm_mul_pd(q2, q2));
+		__m128d f = _mm_sub_pd(_mm_mul_pd(q1, q2), _mm_mul_pd(q0, q5));
+		__m128d g = _mm_sub_pd(_mm_mul_pd(q0, q4), _mm_mul_pd(q1, q1));
+		__m128d x = _mm_add_pd(_mm_add_pd(_mm_mul_pd(a, q3), _mm_mul_pd(b, q6)), _mm_mul_pd(c, q8));
+		__m128d y = _mm_add_pd(_mm_add_pd(_mm_mul_pd(b, q3), _mm_mul_pd(d, q6)), _mm_mul_pd(f, q8));
+		__m128d z = _mm_add_pd(_mm_add_pd(_mm_mul_pd(c, q3), _mm_mul_pd(f, q6)), _mm_mul_pd(g, q8));
+		__m128d error;
+		float out[4];
+		mask = _mm_movemask_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign, det), bound));
+		x = _mm_cvtps_pd(_mm_cvtpd_ps(_mm_div_pd(_mm_xor_pd(x, sign), det)));
+		y = _mm_cvtps_pd(_mm_cvtpd_ps(_mm_div_pd(_mm_xor_pd(y, sign), det)));
+		z = _mm_cvtps_pd(_mm_cvtpd_ps(_mm_div_pd(_mm_xor_pd(z, sign), det)));
+		error = _mm_mul_pd(x, _mm_add_pd(_mm_mul_pd(q0, x), _mm_mul_pd(two,
+			_mm_add_pd(_mm_add_pd(_mm_mul_pd(q1, y), _mm_mul_pd(q2, z)), q3))));
+		error = _mm_add_pd(error, _mm_mul_pd(y, _mm_add_pd(_mm_mul_pd(q4, y), _mm_mul_pd(two, _mm_add_pd(_mm_mul_pd(q5, z), q6)))));
+		error = _mm_add_pd(error, _mm_mul_pd(z, _mm_add_pd(_mm_mul_pd(q7, z), _mm_mul_pd(two, q8))));
+		error = _mm_max_pd(_mm_add_pd(error, q9), zero);
+		_mm_storeu_ps(out, _mm_cvtpd_ps(error));
+		costs[i] = out[0];
+		costs[i + 1] = out[1];
+		solved[i] = mask & 1;
+		solved[i + 1] = (mask >> 1) & 1;
+	}
+	return i;
+}
+#endif
+
+void simpleCostBatch(Edge **edges, int count, float *costs) {
+	float lanes[6][COST_BLOCK];
+	int level = simdLevel(), start, n, i;
+	for(start = 0; start < count; start += COST_BLOCK) {
+		Edge **block = edges + start;
+		float *out = costs + start;
+		n = MIN(COST_BLOCK, count - start);
+		for(i = 0; i < n; i++) {
+			Vertex *head = block[i]->vert, *tail = block[i]->pair->vert;
+			lanes[0][i] = head->x;
+			lanes[1][i] = head->y;
+			lanes[2][i] = head->z;
+			lanes[3][i] = tail->x;
+			lanes[4][i] = tail->y;
+			lanes[5][i] = tail->z;
+		}
+		i = 0;
+#ifdef COST_X86
+		if(level == SIMD_AVX2) i = simpleLanesAvx2(lanes, n, out);
+		else if(level == SIMD_SSE) i = simpleLanesSse(lanes, n, out);
+#endif
+		for(; i < n; i++) out[i] = simpleCost(block[i]);
+	}
+	(void)level;
+}
+
+void garlandCostBatch(Edge **edges, int count, float *costs) {
+	double q[10][COST_BLOCK];
+	unsigned char solved[COST_BLOCK];
+	int level = simdLevel(), start, n, i, j;
+	for(start = 0; start < count; start += COST_BLOCK) {
+		Edge **block = edges + start;
+		float *out = costs + start;
+		n = MIN(COST_BLOCK, count - start);
+		for(i = 0; i < n; i++) {
+			const double *q1 = block[i]->vert->quadric, *q2 = block[i]->pair->vert->quadric;
+			for(j = 0; j < 10; j++) q[j][i] = q1[j] + q2[j];
+		}
+		i = 0;
+#ifdef COST_X86
+		if(level == SIMD_AVX2) i = garlandLanesAvx2(q, n, out, solved);
+		else if(level == SIMD_SSE) i = garlandLanesSse(q, n, out, solved);
+#endif
+		for(j = 0; j < i; j++) {
+			if(!solved[j]) out[j] = garlandCost(block[j]);
+		}
+		for(; i < n; i++) out[i] = garlandCost(block[i]);
+	}
+	(void)level;
+}
@@ -0,0 +1,29 @@
+#ifndef __COSTBATCH_H__
+#define __COSTBATCH_H__
+
+#include "types.h"
+#include "mesh.h"
+
+#define COST_BLOCK 256 /* Edges gathered into lanes at a time */
+
+/* Instruction sets the batch cost kernels can use */
+#define SIMD_SCALAR 0
+#define SIMD_SSE 1
+#define SIMD_AVX2 2
+
+/**
+* Batch cost evaluation. The simple and garland costs have kernels evaluating
+* several edges per instruction, with SSE2 or, where the CPU supports it, AVX2.
+* They do the same operations in the same order as the scalar functions and
+* without fused multiply-adds, so they return the same costs bit for bit. Any
+* other cost function is called once per edge. The instruction set is detected
+* on first use and can be forced with the MESH_SIMD environment variable set to
+* scalar, sse or avx2.
+*/
+
+int simdLevel();
+void evaluateCosts(float (*func)(Edge*), Edge **edges, int count, float *costs);
+void simpleCostBatch(Edge **edges, int count, float *costs);
+void garlandCostBatch(Edge **edges, int count, float *costs);
+
+#endif
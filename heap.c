@@ -1,146 +1,238 @@
 #include "heap.h"
+#include "stats.h"
+#include "costbatch.h"
+#include "parallel.h"
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define PARENT(i) (((i) - 1)/HEAP_ARITY)
+#define CHILD(i) (HEAP_ARITY * (i) + 1)
+
+/* Store an entry at a heap position and point its edge back at it */
+#define PLACE(h, i, entry) do { \
+		(h)->heap[(i)] = (entry); \
+		(h)->mesh->edges[(entry).edge]->heapIndex = (i); \
+	} while(0)
+
+/**
+* Create an empty heap over the edges of m, filled by rebuildHeap.
+*/
 Heap *initHeap(Mesh *m, float (*f)(Edge*), int (*test)(Edge*)) {
 	Heap *h = (Heap*)malloc(sizeof(Heap));
-	EdgeNode *node;
-	int i;
-	
 	h->capacity = m->numEdges;
 	h->size = 0;
+	h->mesh = m;
 	h->func = f;
 	h->test = test;
-	h->heap = (EdgeNode**)malloc(h->capacity * sizeof(EdgeNode*));
-	
-	/* TODO: We can do this in O(n), as is O(n logn) which isn't half bad, (factor of 2-8x) */
-	for(i = 0; i < m->numEdges; i++) {
-		if((*h->test)(m->edges[i])) { /* Edge is collapsable */
-			node = heapInsert(h, m->edges[i]);
-			m->edges[i]->heapNode = node;
-		}
-		else m->edges[i]->heapNode = NULL;
-	}
-	
+	h->heap = (HeapEntry*)malloc(h->capacity * sizeof(HeapEntry));
+	STATS_MEMORY(h->capacity * sizeof(HeapEntry));
 	return h;
 }
 
 void destroyHeap(Heap *h) {
-	int i;
-	for(i = 0; i < h->size; i++) free(h->heap[i]);
+	STATS_MEMORY(-(long long)(h->capacity * sizeof(HeapEntry)));
 	free(h->heap);
 	free(h);
 }
 
-void recalculateKey(Heap *h, Edge *edge) {
-	float cost = (*h->func)(edge);
-	EdgeNode *node;
-	if(edge->heapNode != NULL && !(*h->test)(edge)) removeEdge(h, edge);
-	else if(edge->heapNode == NULL) {
-		if((*h->test)(edge)) {
-			node = heapInsert(h, edge);
-			edge->heapNode = node;
+typedef struct _keyjob {
+	Heap *h;
+	char *valid;
+	float *costs;
+} KeyJob;
+
+/**
+* Test and cost the edges in [start, end) into the flat key arrays, gathering the
+* collapsable ones into blocks for the batch kernels. Only reads the mesh.
+*/
+void keyRange(void *arg, int start, int end) {
+	KeyJob *job = (KeyJob*)arg;
+	Heap *h = job->h;
+	Edge *block[COST_BLOCK];
+	float costs[COST_BLOCK];
+	int index[COST_BLOCK];
+	int i, j, n = 0;
+	for(i = start; i < end; i++) {
+		Edge *edge = h->mesh->edges[i];
+		job->valid[i] = (char)(*h->test)(edge);
+		if(job->valid[i]) {
+			block[n] = edge;
+			index[n++] = i;
 		}
-	}
-	else if(cost == edge->heapNode->cost) return;
-	else {
-		if(cost < edge->heapNode->cost) {
-			edge->heapNode->cost = cost;
-			siftup(h, edge->heapNode->index);
+		if(n == COST_BLOCK || (n > 0 && i == end - 1)) {
+			STATS_ADD(STAT_COST_CALLS, n);
+			evaluateCosts(h->func, block, n, costs);
+			for(j = 0; j < n; j++) job->costs[index[j]] = costs[j];
+			n = 0;
 		}
-		else {
-			edge->heapNode->cost = cost;
-			siftdown(h, edge->heapNode->index);
+	}
+}
+
+/**
+* Re-evaluate every edge of the mesh and rebuild the heap from scratch in O(n),
+* used when the heap is first built and whenever the cost function changes.
+* Keys are computed into flat arrays on meshThreads threads, COST_BLOCK edges at
+* a time with the batch kernels, then gathered in edge order and heapified once,
+* so the heap does not depend on the thread count.
+*/
+void rebuildHeap(Heap *h) {
+	Mesh *m = h->mesh;
+	KeyJob job;
+	int i;
+	STATS_START(start);
+	job.h = h;
+	job.valid = (char*)malloc(m->numEdges + 1);
+	job.costs = (float*)malloc((m->numEdges + 1) * sizeof(float));
+	refreshStaleNormals(m); /* So the workers only read the mesh */
+	parallelFor(m->numEdges, MAX(1, MIN(meshThreads, m->numEdges/HEAP_MIN_EDGES)), keyRange, &job);
+	h->size = 0;
+	for(i = 0; i < m->numEdges; i++) {
+		if(job.valid[i]) { /* Edge is collapsable */
+			h->heap[h->size].cost = job.costs[i];
+			h->heap[h->size].edge = i;
+			h->size++;
 		}
+		else m->edges[i]->heapIndex = -1;
+	}
+	free(job.valid);
+	free(job.costs);
+	heapify(h);
+	STATS_PHASE(PHASE_HEAP, start);
+}
+
+/**
+* Restore the heap property over the whole array with Floyd's bottom up
+* construction, then point every edge at its final position.
+*/
+void heapify(Heap *h) {
+	int i;
+	if(h->size > 1) {
+		for(i = PARENT(h->size - 1); i >= 0; i--) siftdown(h, i);
+	}
+	for(i = 0; i < h->size; i++) h->mesh->edges[h->heap[i].edge]->heapIndex = i;
+}
+
+void recalculateKey(Heap *h, Edge *edge) {
+	STATS_COUNT(STAT_RECALCULATE_KEY);
+	if(!(*h->test)(edge)) removeEdge(h, edge);
+	else {
+		STATS_COUNT(STAT_COST_CALLS);
+		updateKey(h, edge, (*h->func)(edge));
 	}
 }
 
-EdgeNode *heapInsert(Heap *h, Edge *edge) {
-	float cost = (*h->func)(edge);
-	EdgeNode *current;
-	if(!(*h->test)(edge)) return NULL;
-	current = (EdgeNode*)malloc(sizeof(EdgeNode));
-	current->cost = cost;
-	current->edge = edge;
-	current->index = h->size;
-	
-	h->heap[h->size] = current;
-	h->size += 1;
-	siftup(h, h->size - 1);
-	
-	return current;
+/**
+* Set the key of an edge to the given cost, inserting it if it is not in the heap.
+*/
+void updateKey(Heap *h, Edge *edge, float cost) {
+	if(edge->heapIndex < 0) {
+		h->heap[h->size].cost = cost;
+		h->heap[h->size].edge = edge->index;
+		edge->heapIndex = h->size;
+		h->size += 1;
+		siftup(h, h->size - 1);
+	}
+	else if(cost < h->heap[edge->heapIndex].cost) {
+		h->heap[edge->heapIndex].cost = cost;
+		siftup(h, edge->heapIndex);
+	}
+	else if(cost > h->heap[edge->heapIndex].cost) {
+		h->heap[edge->heapIndex].cost = cost;
+		siftdown(h, edge->heapIndex);
+	}
+}
+
+/**
+* Insert the edge if it is collapsable, returning its heap position or -1.
+*/
+int heapInsert(Heap *h, Edge *edge) {
+	if(edge->heapIndex >= 0 || !(*h->test)(edge)) return edge->heapIndex;
+	STATS_COUNT(STAT_COST_CALLS);
+	updateKey(h, edge, (*h->func)(edge));
+	return edge->heapIndex;
+}
+
+/**
+* Cost of the cheapest edge in the heap, or infinity if it is empty.
+*/
+float heapMinCost(Heap *h) {
+	return h->size == 0 ? INFINITY : h->heap[0].cost;
 }
 
 Edge *removeMin(Heap *h) {
 	Edge *edge;
+	STATS_COUNT(STAT_REMOVE_MIN);
 	if(h->size == 0) return NULL;
-	edge = h->heap[0]->edge;
-	edge->heapNode = NULL;
-	
-	h->heap[0] = h->heap[h->size - 1];
-	h->heap[0]->index = 0;
+	edge = h->mesh->edges[h->heap[0].edge];
+	edge->heapIndex = -1;
+
 	h->size--;
-	siftdown(h, 0);
-	
+	if(h->size > 0) {
+		PLACE(h, 0, h->heap[h->size]);
+		siftdown(h, 0);
+	}
+
 	return edge;
 }
 
 void removeEdge(Heap *h, Edge *e) {
-	if(h->size == 0 || e->heapNode == NULL) return;
-	float oldCost = e->heapNode->cost;
-	h->heap[e->heapNode->index] = h->heap[h->size - 1];
-	h->heap[e->heapNode->index]->index = e->heapNode->index;
+	int index = e->heapIndex;
+	float oldCost;
+	if(index < 0) return;
+	oldCost = h->heap[index].cost;
+	e->heapIndex = -1;
 	h->size -= 1;
-	float newCost = h->heap[e->heapNode->index]->cost;
-	if(newCost > oldCost) {
-		siftdown(h, e->heapNode->index);
-	}
-	else if(newCost < oldCost) {
-		siftup(h, e->heapNode->index);
-	}
-	e->heapNode = NULL;
+	if(index == h->size) return;
+	PLACE(h, index, h->heap[h->size]);
+	if(h->heap[index].cost > oldCost) siftdown(h, index);
+	else if(h->heap[index].cost < oldCost) siftup(h, index);
+}
+
+/**
+* Update the heap entry of an edge whose index in the mesh edge array has changed.
+*/
+void moveEdge(Heap *h, Edge *e) {
+	if(e->heapIndex >= 0) h->heap[e->heapIndex].edge = e->index;
 }
 
 void siftdown(Heap *h, int index) {
-	EdgeNode *temp;
+	HeapEntry entry = h->heap[index];
 	while(1) {
-		int left = index * 2 + 1;
-		int right = index * 2 + 2;
-		int largest = index;
-		if(left < h->size && h->heap[left]->cost < h->heap[index]->cost) largest = left;
-		if(right < h->size && h->heap[right]->cost < h->heap[largest]->cost) largest = right;
-		if(largest != index) {
-			temp = h->heap[index];
-			h->heap[index] = h->heap[largest];
-			h->heap[largest] = temp;
-			h->heap[index]->index = index;
-			h->heap[largest]->index = largest;
-			index = largest;
-			continue;
+		int child = CHILD(index);
+		int last = child + HEAP_ARITY;
+		int smallest = index;
+		float cost = entry.cost;
+		if(last > h->size) last = h->size;
+		for(; child < last; child++) {
+			if(h->heap[child].cost < cost) {
+				smallest = child;
+				cost = h->heap[child].cost;
+			}
 		}
-		break;
+		if(smallest == index) break;
+		STATS_COUNT(STAT_SIFT_STEPS);
+		PLACE(h, index, h->heap[smallest]);
+		index = smallest;
 	}
+	PLACE(h, index, entry);
 }
 
 void siftup(Heap *h, int index) {
-	EdgeNode *temp;
-	while(index > 0 && h->heap[(index - 1)/2]->cost > h->heap[index]->cost) {
-		temp = h->heap[index];
-		h->heap[index] = h->heap[(index - 1)/2];
-		h->heap[(index - 1)/2] = temp;
-		h->heap[index]->index = index;
-		h->heap[(index - 1)/2]->index = (index - 1)/2;
-		index = (index - 1)/2;
+	HeapEntry entry = h->heap[index];
+	while(index > 0 && h->heap[PARENT(index)].cost > entry.cost) {
+		STATS_COUNT(STAT_SIFT_STEPS);
+		PLACE(h, index, h->heap[PARENT(index)]);
+		index = PARENT(index);
 	}
-}
-
-int check(Heap *h, int index) {
-	if(index >= h->size) return 1;
-	if(h->heap[(index - 1)/2]->cost > h->heap[index]->cost) return 0;
-	if(h->heap[index]->edge->heapNode != h->heap[index]) return 0;
-	return check(h, 2 * index + 1) && check(h, 2 * index + 2);
+	PLACE(h, index, entry);
 }
 
 int verifyHeap(Heap *h) {
-	if(h->heap[0]->edge->heapNode != h->heap[0]) return 0;
-	if(h->size == 0) return 1;
-	return check(h, 1) && check(h, 2);
+	int i;
+	for(i = 0; i < h->size; i++) {
+		if(i > 0 && h->heap[PARENT(i)].cost > h->heap[i].cost) return 0;
+		if(h->mesh->edges[h->heap[i].edge]->heapIndex != i) return 0;
+		if(h->mesh->edges[h->heap[i].edge]->index != h->heap[i].edge) return 0;
+	}
+	return 1;
 }
@@ -3,17 +3,26 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include "types.h"
 #define __UNUSED(x) (void)x;
 
+#define HEAP_ARITY 4
+#define HEAP_MIN_EDGES 16384 /* Fewest edges worth another thread when keying the whole mesh */
+
 Heap *initHeap(Mesh *m, float (*f)(Edge*), int (*test)(Edge*));
 void destroyHeap(Heap *h);
+void rebuildHeap(Heap *h);
+void heapify(Heap *h);
 
 void recalculateKey(Heap *h, Edge *edge);
+void updateKey(Heap *h, Edge *edge, float cost);
 
-EdgeNode *heapInsert(Heap *h, Edge *edge);
+int heapInsert(Heap *h, Edge *edge);
+float heapMinCost(Heap *h);
 Edge *removeMin(Heap *h);
 void removeEdge(Heap *h, Edge *e);
+void moveEdge(Heap *h, Edge *e);
 
 void siftdown(Heap *h, int index);
 void siftup(Heap *h, int index);
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+#include "lod.h"
+
+/**
+* Start an export of the levels of detail of m. Vertices remember their entry
+* in the export until they move, so only one export per mesh may be captured at a time.
+*/
+LodExport *initLodExport(Mesh *m) {
+	LodExport *x = (LodExport*)malloc(sizeof(LodExport));
+	int i;
+	x->entryCapacity = m->numVertices > 0 ? m->numVertices : 1;
+	x->numEntries = 0;
+	x->positions = (float*)malloc(3 * x->entryCapacity * sizeof(float));
+	x->lastLevel = (int*)malloc(x->entryCapacity * sizeof(int));
+	x->levelCapacity = 4;
+	x->numLevels = 0;
+	x->indices = (uint32_t**)malloc(x->levelCapacity * sizeof(uint32_t*));
+	x->numFaces = (int*)malloc(x->levelCapacity * sizeof(int));
+	for(i = 0; i < m->numVertices; i++) m->verts[i]->snapshot = -1;
+	return x;
+}
+
+void destroyLodExport(LodExport *x) {
+	int i;
+	for(i = 0; i < x->numLevels; i++) free(x->indices[i]);
+	free(x->indices);
+	free(x->numFaces);
+	free(x->positions);
+	free(x->lastLevel);
+	free(x);
+}
+
+/**
+* Add the current state of m as the next, coarser, level of detail. Vertices that
+* have not moved since the previous capture reuse their entry.
+*/
+void captureLod(LodExport *x, Mesh *m) {
+	int level = x->numLevels;
+	uint32_t *indices;
+	int i;
+	if(x->numLevels == x->levelCapacity) {
+		x->levelCapacity *= 2;
+		x->indices = (uint32_t**)realloc(x->indices, x->levelCapacity * sizeof(uint32_t*));
+		x->numFaces = (int*)realloc(x->numFaces, x->levelCapacity * sizeof(int));
+	}
+	for(i = 0; i < m->numVertices; i++) {
+		Vertex *v = m->verts[i];
+		if(v->snapshot < 0) {
+			if(x->numEntries == x->entryCapacity) {
+				x->entryCapacity *= 2;
+				x->positions = (float*)realloc(x->positions, 3 * x->entryCapacity * sizeof(float));
+				x->lastLevel = (int*)realloc(x->lastLevel, x->entryCapacity * sizeof(int));
+			}
+			v->snapshot = x->numEntries++;
+			x->positions[3 * v->snapshot] = v->x;
+			x->positions[3 * v->snapshot + 1] = v->y;
+			x->positions[3 * v->snapshot + 2] = v->z;
+		}
+		x->lastLevel[v->snapshot] = level;
+	}
+	indices = (uint32_t*)malloc((3 * (size_t)m->numFaces + 1) * sizeof(uint32_t));
+	for(i = 0; i < m->numFaces; i++) {
+		Edge *edge = m->faces[i]->edge;
+		indices[3 * i] = edge->vert->snapshot;
+		indices[3 * i + 1] = edge->next->vert->snapshot;
+		indices[3 * i + 2] = edge->next->next->vert->snapshot;
+	}
+	x->indices[level] = indices;
+	x->numFaces[level] = m->numFaces;
+	x->numLevels++;
+}
+
+/**
+* Write every captured level to fileName. Entries are ordered by the coarsest
+* level that uses them, coarsest first and otherwise in capture order, so each
+* level only references a prefix of the vertex array. Returns 1 on success.
+*/
+int writeLodExport(LodExport *x, char *fileName) {
+	LodHeader header;
+	uint32_t *order, *counts, *remap, *indices;
+	float *positions;
+	FILE *f;
+	int i, level, ok;
+
+	/* Counting sort of the entries by descending last level */
+	counts = (uint32_t*)calloc(x->numLevels + 1, sizeof(uint32_t));
+	for(i = 0; i < x->numEntries; i++) counts[x->numLevels - 1 - x->lastLevel[i] + 1]++;
+	for(level = 1; level <= x->numLevels; level++) counts[level] += counts[level - 1];
+	order = (uint32_t*)malloc((x->numEntries + 1) * sizeof(uint32_t));
+	remap = (uint32_t*)malloc((x->numEntries + 1) * sizeof(uint32_t));
+	for(i = 0; i < x->numEntries; i++) {
+		uint32_t slot = counts[x->numLevels - 1 - x->lastLevel[i]]++;
+		order[slot] = i;
+		remap[i] = slot;
+	}
+	positions = (float*)malloc((3 * (size_t)x->numEntries + 1) * sizeof(float));
+	for(i = 0; i < x->numEntries; i++) memcpy(positions + 3 * i, x->positions + 3 * order[i], 3 * sizeof(float));
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LOD_MAGIC, sizeof(LOD_MAGIC));
+	header.version = LOD_VERSION;
+	header.byteOrder = LOD_BYTE_ORDER;
+	header.numVertices = x->numEntries;
+	header.numLevels = x->numLevels;
+
+	f = fopen(fileName, "wb");
+	if(f == NULL) {
+		free(counts);
+		free(order);
+		free(remap);
+		free(positions);
+		return 0;
+	}
+	ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	for(level = 0; level < x->numLevels && ok; level++) {
+		/* After the sort counts[k] is the number of entries used by levels numLevels - 1 - k and coarser */
+		uint32_t sizes[2];
+		sizes[0] = counts[x->numLevels - 1 - level];
+		sizes[1] = x->numFaces[level];
+		ok = fwrite(sizes, sizeof(uint32_t), 2, f) == 2;
+	}
+	ok = ok && fwrite(positions, sizeof(float), 3 * (size_t)x->numEntries, f) == 3 * (size_t)x->numEntries;
+	for(level = 0; level < x->numLevels && ok; level++) {
+		size_t count = 3 * (size_t)x->numFaces[level];
+		indices = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+		for(i = 0; i < (int)count; i++) indices[i] = remap[x->indices[level][i]];
+		ok = fwrite(indices, sizeof(uint32_t), count, f) == count;
+		free(indices);
+	}
+	ok = fclose(f) == 0 && ok;
+
+	free(counts);
+	free(order);
+	free(remap);
+	free(positions);
+	return ok;
+}
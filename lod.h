@@ -0,0 +1,45 @@
+#ifndef __LOD_H__
+#define __LOD_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "mesh.h"
+
+#define LOD_MAGIC "MESHLOD"
+#define LOD_VERSION 1
+#define LOD_BYTE_ORDER 0x01020304u
+
+/**
+* Header of a multi level of detail file. It is followed by numLevels pairs of
+* uint32 {numVertices, numFaces}, finest level first, then the float xyz
+* positions of all vertices and then the triangle indices of every level in
+* the same order. Level i only indexes the first numVertices of the shared
+* vertex array, and coarser levels use shorter prefixes.
+*/
+typedef struct _lodheader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder; /* LOD_BYTE_ORDER as written by the producing machine */
+	uint32_t numVertices, numLevels;
+	uint32_t reserved[4];
+} LodHeader;
+
+/**
+* Levels of detail captured from one reduction. Every distinct vertex position
+* seen by a capture is an entry, remembered with the coarsest level using it.
+*/
+typedef struct _lodexport {
+	float *positions;
+	int *lastLevel;
+	int numEntries, entryCapacity;
+	uint32_t **indices; /* Entry triples of each level */
+	int *numFaces;
+	int numLevels, levelCapacity;
+} LodExport;
+
+LodExport *initLodExport(Mesh *m);
+void destroyLodExport(LodExport *x);
+void captureLod(LodExport *x, Mesh *m);
+int writeLodExport(LodExport *x, char *fileName);
+
+#endif
@@ -1,43 +1,131 @@
 #include "mesh.h"
+#include "parallel.h"
+#include "progressive.h"
+#include "stats.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define DOT(a, b) ((a)[0] * (b)[0] + (a)[1] * (b)[1] + (a)[2] * (b)[2])
+#define CROSS(r, a, b) do { \
+		(r)[0] = (a)[1] * (b)[2] - (a)[2] * (b)[1]; \
+		(r)[1] = (a)[2] * (b)[0] - (a)[0] * (b)[2]; \
+		(r)[2] = (a)[0] * (b)[1] - (a)[1] * (b)[0]; \
+	} while(0)
+
+/* Edges tested by one localDelaunay call at most */
+#define DELAUNAY_QUEUE 128
+/* Relative margin by which the opposite angles must exceed pi, so cocircular quads are left alone */
+#define DELAUNAY_EPSILON 1e-6
+/* Smallest cosine of the dihedral angle across an edge that may be flipped */
+#define DELAUNAY_FLATNESS 0.95
+/* Slots of the vertex set used by the link condition, a power of two */
+#define LINK_SLOTS 256
+#define ROUND_MIN 64 /* Fewest collapses attempted per parallel round */
+#define ROUND_DIVISOR 64 /* Each parallel round collapses at most numFaces/ROUND_DIVISOR edges */
 
 float (*currentCost)(Edge*) = simpleCost;
+int deferHeap = 0;
+int meshThreads = 1;
+
+/* Vertex set of the link condition, private to each thread as collapsable runs on several */
+__thread int linkVerts[LINK_SLOTS];
+__thread unsigned int linkStamps[LINK_SLOTS];
+__thread unsigned int linkEpoch = 0;
+__thread int linkSize = 0;
 
-Mesh *initMesh(int numVertices, int numFaces, int numEdges, Vertex** verts, Face** faces, Edge** edges) {
+/**
+* Allocate an empty mesh with room for the given number of elements. The
+* element pools are sized so a loader filling the mesh carves every element
+* out of one block per type. Call buildMesh once the elements are linked.
+*/
+Mesh *initMesh(int numVertices, int numFaces, int numEdges) {
 	Mesh *m = (Mesh*)malloc(sizeof(Mesh));
+	STATS_INIT();
 	m->numVertices = numVertices;
 	m->numFaces = numFaces;
 	m->numEdges = numEdges;
-	m->verts = verts;
-	m->faces = faces;
-	m->edges = edges;
-	m->heap = initHeap(m, currentCost, collapsable);
+	m->verts = (Vertex**)malloc(numVertices * sizeof(Vertex*));
+	m->faces = (Face**)malloc(numFaces * sizeof(Face*));
+	m->edges = (Edge**)malloc(numEdges * sizeof(Edge*));
+	initPool(&m->vertPool, sizeof(Vertex), numVertices);
+	initPool(&m->facePool, sizeof(Face), numFaces);
+	initPool(&m->edgePool, sizeof(Edge), numEdges);
+	m->heap = NULL;
+	m->epoch = 0;
+	m->numDirty = 0;
+	m->dirtyCapacity = 64;
+	m->dirty = (Edge**)malloc(m->dirtyCapacity * sizeof(Edge*));
+	m->rekeyed = 0;
+	m->rekeySkipped = 0;
+	m->recorder = NULL;
+	m->changes = NULL;
 	return m;
 }
 
+/**
+* Finish construction of a fully linked mesh by computing the vertex quadrics and edge heap.
+* With deferHeap set the heap is left empty, for the caller to fill once with changeCostFunc.
+*/
+void buildMesh(Mesh *m) {
+	computeQuadrics(m);
+	m->heap = initHeap(m, currentCost, collapsable);
+	if(!deferHeap) rebuildHeap(m->heap);
+}
+
+Vertex *newVertex(Mesh *m) {
+	Vertex *v = (Vertex*)poolAlloc(&m->vertPool);
+	v->stamp = 0;
+	v->snapshot = -1;
+	v->locked = 0;
+	return v;
+}
+
+Edge *newEdge(Mesh *m) {
+	Edge *e = (Edge*)poolAlloc(&m->edgePool);
+	e->heapIndex = -1;
+	e->stamp = 0;
+	return e;
+}
+
+Face *newFace(Mesh *m) {
+	Face *f = (Face*)poolAlloc(&m->facePool);
+	f->stale = 1;
+	return f;
+}
+
 void changeCostFunc(Mesh *m, float (*func)(Edge*)) {
 	m->heap->func = func;
 	currentCost = func;
-	for(int i = 0; i < m->numEdges; i++) {
-		recalculateKey(m->heap, m->edges[i]);
-	}
+	rebuildHeap(m->heap);
+	if(m->recorder != NULL) m->recorder->detached = 0;
 }
 
 void destroyMesh(Mesh* m) {
-	int i;
-	destroyHeap(m->heap);
-	for(i = 0; i < m->numEdges; i++) free(m->edges[i]);
-	for(i = 0; i < m->numVertices; i++) free(m->verts[i]);
-	for(i = 0; i < m->numFaces; i++) free(m->faces[i]);
+	if(m->heap != NULL) destroyHeap(m->heap);
+	destroyPool(&m->edgePool);
+	destroyPool(&m->vertPool);
+	destroyPool(&m->facePool);
 	free(m->edges);
 	free(m->verts);
 	free(m->faces);
+	free(m->dirty);
+	if(m->recorder != NULL) {
+		free(m->recorder->records);
+		free(m->recorder->flips.flips);
+		free(m->recorder);
+	}
+	if(m->changes != NULL) {
+		free(m->changes->verts);
+		free(m->changes->faces);
+		free(m->changes);
+	}
 	free(m);
 }
 
-void faceNormal(Face *f, float result[3]) {
+/**
+* Recompute the cached normal of f from its vertex positions.
+*/
+void updateNormal(Face *f) {
 	Edge *edge = f->edge;
 	
 	Vertex *vert = edge->vert;
@@ -54,9 +142,86 @@ void faceNormal(Face *f, float result[3]) {
 	
 	float len = sqrt(cx * cx + cy * cy + cz * cz);
 	
-	result[0] = cx/len;
-	result[1] = cy/len;
-	result[2] = cz/len;
+	f->normal[0] = cx/len;
+	f->normal[1] = cy/len;
+	f->normal[2] = cz/len;
+	f->stale = 0;
+}
+
+/**
+* Fetch the normal of f, refreshing the cached value if the face was marked stale.
+*/
+void faceNormal(Face *f, float result[3]) {
+	if(f->stale) updateNormal(f);
+	result[0] = f->normal[0];
+	result[1] = f->normal[1];
+	result[2] = f->normal[2];
+}
+
+/**
+* Refresh the stale normals of the faces around v.
+*/
+void refreshRing(Vertex *v) {
+	Edge *edge = v->edge;
+	do {
+		if(edge->face->stale) updateNormal(edge->face);
+		edge = edge->pair->prev;
+	} while(edge != v->edge);
+}
+
+/**
+* Refresh every stale normal of m. Cost functions such as melaxCost refresh the
+* normals they read, so this runs before they are evaluated on several threads.
+*/
+void refreshStaleNormals(Mesh *m) {
+	int i;
+	for(i = 0; i < m->numFaces; i++) {
+		if(m->faces[i]->stale) updateNormal(m->faces[i]);
+	}
+}
+
+/**
+* Refresh the stale normals of the faces around v and its neighbours. After a
+* contraction of e to v and the local Delaunay flips around v, this covers every
+* face either of them marked stale, so parallel readers only see fresh normals.
+*/
+void refreshNormals(Vertex *v) {
+	Edge *edge = v->edge;
+	do {
+		refreshRing(edge->pair->vert);
+		edge = edge->pair->prev;
+	} while(edge != v->edge);
+}
+
+/**
+* Build the Garland-Heckbert error quadric of every vertex as the sum of
+* the fundamental quadrics of the planes of its incident faces.
+*/
+void computeQuadrics(Mesh *m) {
+	int i, j;
+	float n[3];
+	double p[4];
+	Edge *edge;
+	for(i = 0; i < m->numVertices; i++) {
+		for(j = 0; j < 10; j++) m->verts[i]->quadric[j] = 0.0;
+	}
+	for(i = 0; i < m->numFaces; i++) {
+		faceNormal(m->faces[i], n);
+		if(n[0] != n[0] || n[1] != n[1] || n[2] != n[2]) continue; /* Degenerate face */
+		edge = m->faces[i]->edge;
+		p[0] = n[0];
+		p[1] = n[1];
+		p[2] = n[2];
+		p[3] = -(p[0] * edge->vert->x + p[1] * edge->vert->y + p[2] * edge->vert->z);
+		do {
+			double *q = edge->vert->quadric;
+			q[0] += p[0] * p[0]; q[1] += p[0] * p[1]; q[2] += p[0] * p[2]; q[3] += p[0] * p[3];
+			q[4] += p[1] * p[1]; q[5] += p[1] * p[2]; q[6] += p[1] * p[3];
+			q[7] += p[2] * p[2]; q[8] += p[2] * p[3];
+			q[9] += p[3] * p[3];
+			edge = edge->next;
+		} while(edge != m->faces[i]->edge);
+	}
 }
 
 /**
@@ -65,10 +230,32 @@ void faceNormal(Face *f, float result[3]) {
 * The vertex should be removed from the mesh before being deleted.
 */
 void deleteVert(Mesh *m, Vertex *v) {
+	detachVert(m, v);
+	poolFree(&m->vertPool, v);
+}
+
+/**
+* Take the vertex out of the vertex array without releasing it. The last
+* vertex takes its slot, and v keeps its old index for restoreVert.
+*/
+void detachVert(Mesh *m, Vertex *v) {
 	m->verts[v->index] = m->verts[m->numVertices - 1];
 	m->verts[v->index]->index = v->index;
 	m->numVertices -= 1;
-	free(v);
+	if(m->verts[v->index] != v) logVertex(m, m->verts[v->index]);
+}
+
+/**
+* Put a detached vertex back in its old slot. Undoes detachVert exactly when
+* detachments are undone in reverse order.
+*/
+void restoreVert(Mesh *m, Vertex *v) {
+	m->verts[m->numVertices] = m->verts[v->index];
+	m->verts[m->numVertices]->index = m->numVertices;
+	m->verts[v->index] = v;
+	m->numVertices += 1;
+	logVertex(m, m->verts[m->numVertices - 1]);
+	logVertex(m, v);
 }
 
 /**
@@ -77,11 +264,31 @@ void deleteVert(Mesh *m, Vertex *v) {
 * The edge should be removed from the mesh before being deleted.
 */
 void deleteEdge(Mesh *m, Edge *e) {
+	detachEdge(m, e);
+	poolFree(&m->edgePool, e);
+}
+
+/**
+* Take the edge out of the heap and the edge array without releasing it.
+*/
+void detachEdge(Mesh *m, Edge *e) {
+	removeEdge(m->heap, e);
 	m->edges[e->index] = m->edges[m->numEdges - 1];
 	m->edges[e->index]->index = e->index;
+	moveEdge(m->heap, m->edges[e->index]);
 	m->numEdges -= 1;
-	removeEdge(m->heap, e);
-	free(e);
+}
+
+/**
+* Put a detached edge back in its old slot, outside of the heap.
+*/
+void restoreEdge(Mesh *m, Edge *e) {
+	m->edges[m->numEdges] = m->edges[e->index];
+	m->edges[m->numEdges]->index = m->numEdges;
+	moveEdge(m->heap, m->edges[m->numEdges]);
+	m->edges[e->index] = e;
+	e->heapIndex = -1;
+	m->numEdges += 1;
 }
 
 /**
@@ -90,10 +297,52 @@ void deleteEdge(Mesh *m, Edge *e) {
 * The face should be removed from the mesh before being deleted.
 */
 void deleteFace(Mesh *m, Face *f) {
+	detachFace(m, f);
+	poolFree(&m->facePool, f);
+}
+
+void detachFace(Mesh *m, Face *f) {
 	m->faces[f->index] = m->faces[m->numFaces - 1];
 	m->faces[f->index]->index = f->index;
 	m->numFaces -= 1;
-	free(f);
+	if(m->faces[f->index] != f) logFace(m, m->faces[f->index]);
+}
+
+void restoreFace(Mesh *m, Face *f) {
+	m->faces[m->numFaces] = m->faces[f->index];
+	m->faces[m->numFaces]->index = m->numFaces;
+	m->faces[f->index] = f;
+	f->stale = 1;
+	m->numFaces += 1;
+	logFace(m, m->faces[m->numFaces - 1]);
+	logFace(m, f);
+}
+
+/**
+* Note that v moved or changed slot, and that the faces of its 2-ring may have
+* changed, for the attached render buffer. Does nothing if none is attached.
+*/
+void logVertex(Mesh *m, Vertex *v) {
+	ChangeLog *log = m->changes;
+	if(log == NULL) return;
+	if(log->numVerts == log->vertCapacity) {
+		log->vertCapacity *= 2;
+		log->verts = (Vertex**)realloc(log->verts, log->vertCapacity * sizeof(Vertex*));
+	}
+	log->verts[log->numVerts++] = v;
+}
+
+/**
+* Note that f changed slot for the attached render buffer.
+*/
+void logFace(Mesh *m, Face *f) {
+	ChangeLog *log = m->changes;
+	if(log == NULL) return;
+	if(log->numFaces == log->faceCapacity) {
+		log->faceCapacity *= 2;
+		log->faces = (Face**)realloc(log->faces, log->faceCapacity * sizeof(Face*));
+	}
+	log->faces[log->numFaces++] = f;
 }
 
 /**
@@ -146,6 +395,57 @@ void edgeFlip(Edge *e) {
 	/* Change face -> edge pointers */
 	e->face->edge = e;
 	e->pair->face->edge = e->pair;
+	e->face->stale = 1;
+	e->pair->face->stale = 1;
+}
+
+/**
+* Save what undoFlip needs to reverse a flip of e, call before edgeFlip(e).
+*/
+void saveFlip(Edge *e, FlipRecord *r) {
+	r->edge = e;
+	r->vertEdge[0] = e->vert->edge;
+	r->vertEdge[1] = e->pair->vert->edge;
+	r->faceEdge[0] = e->face->edge;
+	r->faceEdge[1] = e->pair->face->edge;
+}
+
+/**
+* Reverse a flip exactly. Flipping again would rotate the edge further instead.
+*/
+void undoFlip(const FlipRecord *r) {
+	Edge *e = r->edge;
+	Edge *en = e->prev;
+	Edge *epp = e->next;
+	Edge *ep = e->pair->next;
+	Edge *epn = e->pair->prev;
+	
+	e->vert = epp->vert;
+	e->pair->vert = ep->vert;
+	
+	e->next = en;
+	e->prev = ep;
+	en->next = ep;
+	en->prev = e;
+	ep->next = e;
+	ep->prev = en;
+	
+	e->pair->next = epn;
+	e->pair->prev = epp;
+	epn->next = epp;
+	epn->prev = e->pair;
+	epp->next = e->pair;
+	epp->prev = epn;
+	
+	ep->face = e->face;
+	epp->face = e->pair->face;
+	
+	e->vert->edge = r->vertEdge[0];
+	e->pair->vert->edge = r->vertEdge[1];
+	e->face->edge = r->faceEdge[0];
+	e->pair->face->edge = r->faceEdge[1];
+	e->face->stale = 1;
+	e->pair->face->stale = 1;
 }
 
 double magnitude(Edge *e) {
@@ -155,72 +455,176 @@ double magnitude(Edge *e) {
 	return sqrt(dx * dx + dy * dy + dz * dz);
 }
 
-double minAngle(Edge *e1) {
-	Edge *e2 = e1->next;
-	Edge *e3 = e2->next;
+/**
+* Number of edges around v.
+*/
+int vertexDegree(Vertex *v) {
+	Edge *e = v->edge;
+	int degree = 0;
+	do {
+		degree++;
+		e = e->pair->prev;
+	} while(e != v->edge);
+	return degree;
+}
+
+/**
+* Decide whether e should be flipped to make it locally Delaunay, before changing
+* anything. An edge is not Delaunay when the two angles opposite to it add up to
+* more than pi, that is when cot(alpha) + cot(beta) < 0. The flip must also keep
+* the mesh manifold and in place: the head of e keeps at least three edges, the
+* new diagonal is not an edge already, the two faces are close to coplanar and
+* the quad they form is convex, so neither new face is folded over. Locked vertices
+* are not joined either, another chunk may join the same two.
+*/
+int delaunayFlip(Edge *e) {
+	Vertex *v = e->vert, *w = e->pair->vert;
+	Vertex *a = e->next->vert, *b = e->pair->next->vert;
+	double va[3], wa[3], vb[3], wb[3], n1[3], n2[3], m1[3], m2[3], sum[3];
+	double len1, len2, cotA, cotB;
+	Edge *ring;
+	
+	if(a == b || (a->locked && b->locked) || vertexDegree(w) <= 3) return 0;
+	
+	va[0] = v->x - a->x; va[1] = v->y - a->y; va[2] = v->z - a->z;
+	wa[0] = w->x - a->x; wa[1] = w->y - a->y; wa[2] = w->z - a->z;
+	vb[0] = v->x - b->x; vb[1] = v->y - b->y; vb[2] = v->z - b->z;
+	wb[0] = w->x - b->x; wb[1] = w->y - b->y; wb[2] = w->z - b->z;
+	
+	/* Twice the areas of the faces (w, v, a) and (v, w, b) */
+	CROSS(n1, wa, va);
+	CROSS(n2, vb, wb);
+	len1 = sqrt(DOT(n1, n1));
+	len2 = sqrt(DOT(n2, n2));
+	if(len1 == 0.0 || len2 == 0.0) return 0;
 	
-	double len1 = sqrt((e1->vert->x - e3->vert->x) * (e1->vert->x - e3->vert->x) +
-				  (e1->vert->y - e3->vert->y) * (e1->vert->y - e3->vert->y) +
-				  (e1->vert->z - e3->vert->z) * (e1->vert->z - e3->vert->z));
-	double len2 = sqrt((e2->vert->x - e3->vert->x) * (e2->vert->x - e3->vert->x) +
-				  (e2->vert->y - e3->vert->y) * (e2->vert->y - e3->vert->y) +
-				  (e2->vert->z - e3->vert->z) * (e2->vert->z - e3->vert->z));
-	double len3 = sqrt((e2->vert->x - e1->vert->x) * (e2->vert->x - e1->vert->x) +
-				  (e2->vert->y - e1->vert->y) * (e2->vert->y - e1->vert->y) +
-				  (e2->vert->z - e1->vert->z) * (e2->vert->z - e1->vert->z));
-				  
-	double t1 = acos(((e1->vert->x - e3->vert->x) * (e2->vert->x - e3->vert->x) +
-				(e1->vert->y - e3->vert->y) * (e2->vert->y - e3->vert->y) +
-				(e1->vert->z - e3->vert->z) * (e2->vert->z - e3->vert->z))/(len1 * len2));
+	/* cot(alpha) = dot/|cross| at the opposite vertices, compared without dividing */
+	cotA = DOT(wa, va);
+	cotB = DOT(vb, wb);
+	if(cotA * len2 + cotB * len1 >= -DELAUNAY_EPSILON * len1 * len2) return 0;
+	if(DOT(n1, n2) < DELAUNAY_FLATNESS * len1 * len2) return 0;
 	
-	double t2 = acos(((e3->vert->x - e1->vert->x) * (e2->vert->x - e1->vert->x) +
-				(e3->vert->y - e1->vert->y) * (e2->vert->y - e1->vert->y) +
-				(e3->vert->z - e1->vert->z) * (e2->vert->z - e1->vert->z))/(len1 * len3));
-				
-	double t3 = acos(((e3->vert->x - e2->vert->x) * (e1->vert->x - e2->vert->x) +
-				(e3->vert->y - e2->vert->y) * (e1->vert->y - e2->vert->y) +
-				(e3->vert->z - e2->vert->z) * (e1->vert->z - e2->vert->z))/(len2 * len3));
-				
-	return MIN(t1, MIN(t2, t3));
+	/* The new faces (a, w, b) and (b, v, a) must face the same way as the old ones */
+	sum[0] = n1[0] + n2[0]; sum[1] = n1[1] + n2[1]; sum[2] = n1[2] + n2[2];
+	CROSS(m1, wb, wa);
+	CROSS(m2, va, vb);
+	if(DOT(m1, sum) <= 0.0 || DOT(m2, sum) <= 0.0) return 0;
+	
+	ring = a->edge;
+	do {
+		if(ring->pair->vert == b) return 0;
+		ring = ring->pair->prev;
+	} while(ring != a->edge);
+	return 1;
 }
 
 /**
-* Perform edge flipping to obtain a locally delaunay triangulation around a vertex.
+* Restore the Delaunay property around v after a collapse by flipping the edges
+* at v that fail the delaunayFlip test. Flipping an edge changes the faces of its
+* two neighbours around v, so they are queued for another test. Every flip lowers
+* the degree of v, so the number of flips is bounded by it, and only edges and
+* faces around v are written. The ends of a new diagonal are kept around v, so it
+* stays in the 2-ring whose keys are recalculated after the collapse.
 */
-void localDelaunay(Vertex *v) {
-	Edge *e;
-	int found = 0;
-	while(1) {
-		found = 0;
-		e = v->edge;
-		do {
-			double angle1 = MIN(minAngle(e), minAngle(e->pair));
-			edgeFlip(e);
-			double angle2 = MIN(minAngle(e), minAngle(e->pair));
-			if(angle1 >= angle2 || abs(angle1 - angle2) < 1e-4) {
-				edgeFlip(e);
-			}
-			else {
-				found = 1;
-				break;
-			}
-			e = e->pair->prev;
-		} while(e != v->edge);
-		if(!found) break;
+void localDelaunay(Vertex *v, FlipLog *log) {
+	Edge *queue[DELAUNAY_QUEUE];
+	Vertex *pinned[2 * DELAUNAY_QUEUE]; /* Ends of the diagonals flipped in so far */
+	Edge *e, *left, *right;
+	FlipRecord flip;
+	int head = 0, size = 0, degree = 0, numPinned = 0, i;
+	STATS_START(start);
+	
+	e = v->edge;
+	do {
+		if(size < DELAUNAY_QUEUE) queue[size++] = e;
+		degree++;
+		e = e->pair->prev;
+	} while(e != v->edge);
+	
+	while(head < size && degree > 3 && numPinned < 2 * DELAUNAY_QUEUE) {
+		e = queue[head++];
+		if(e->pair->vert == v) e = e->pair;
+		else if(e->vert != v) continue; /* Flipped away since it was queued */
+		for(i = 0; i < numPinned && pinned[i] != e->pair->vert; i++);
+		if(i < numPinned) continue;
+		STATS_COUNT(STAT_FLIP_TESTS);
+		if(!delaunayFlip(e)) continue;
+		
+		left = e->next;
+		right = e->pair->prev;
+		pinned[numPinned++] = e->next->vert;
+		pinned[numPinned++] = e->pair->next->vert;
+		saveFlip(e, &flip);
+		edgeFlip(e);
+		/* Refresh the flipped faces while they are ours rather than leaving them stale */
+		updateNormal(e->face);
+		updateNormal(e->pair->face);
+		STATS_COUNT(STAT_FLIPS);
+		if(log != NULL) appendFlip(log, &flip);
+		degree--;
+		if(size < DELAUNAY_QUEUE) queue[size++] = left;
+		if(size < DELAUNAY_QUEUE) queue[size++] = right;
+	}
+	STATS_PHASE(PHASE_DELAUNAY, start);
+}
+
+/**
+* Add e to the dirty set unless it was already gathered during the current epoch.
+*/
+void markDirty(Mesh *m, Edge *e) {
+	if(e->stamp == m->epoch) {
+		m->rekeySkipped++;
+		return;
+	}
+	e->stamp = m->epoch;
+	if(m->numDirty == m->dirtyCapacity) {
+		m->dirtyCapacity *= 2;
+		m->dirty = (Edge**)realloc(m->dirty, m->dirtyCapacity * sizeof(Edge*));
+	}
+	m->dirty[m->numDirty++] = e;
+}
+
+/**
+* Start a new dirty set. Stamps are only compared for equality, so when the epoch
+* wraps around every stamp is cleared to keep stale ones from matching.
+*/
+void clearDirty(Mesh *m) {
+	int i;
+	m->numDirty = 0;
+	m->epoch++;
+	if(m->epoch == 0) {
+		for(i = 0; i < m->numEdges; i++) m->edges[i]->stamp = 0;
+		for(i = 0; i < m->numVertices; i++) m->verts[i]->stamp = 0;
+		m->epoch = 1;
 	}
 }
 
 /**
- * Recalculate edge removal costs for all edges adjacent to v
+ * Recalculate edge removal costs for all edges adjacent to v. The half edges of
+ * the 2-ring are gathered into the dirty set first, so edges shared between
+ * neighbouring rings are evaluated only once.
  */
 void recalculate(Mesh *m, Vertex *v) {
+	int i;
+	STATS_START(start);
+	clearDirty(m);
+	gatherDirty(m, v);
+	for(i = 0; i < m->numDirty; i++) recalculateKey(m->heap, m->dirty[i]);
+	m->rekeyed += m->numDirty;
+	STATS_PHASE(PHASE_REKEY, start);
+}
+
+/**
+* Add the half edges of the 2-ring of v to the dirty set.
+*/
+void gatherDirty(Mesh *m, Vertex *v) {
 	Edge *edge = v->edge;
 	Edge *second;
 	do {
 		second = edge->pair;
 		do {
-			recalculateKey(m->heap, second);
-			recalculateKey(m->heap, second->pair);
+			markDirty(m, second);
+			markDirty(m, second->pair);
 			second = second->pair->prev;
 		} while(second != edge->pair);
 		edge = edge->pair->prev;
@@ -231,15 +635,12 @@ void recalculate(Mesh *m, Vertex *v) {
 * Simple edge removal cost as in lecture notes. Dihedral angle between triangles combined with length of the edge joining them
 */
 float simpleCost(Edge *e) {
-	float normal1[3], normal2[3];
 	float dx, dy, dz;
-	faceNormal(e->face, normal1);
-	faceNormal(e->pair->face, normal2);
 	dx = e->vert->x - e->pair->vert->x;
 	dy = e->vert->y - e->pair->vert->y;
 	dz = e->vert->z - e->pair->vert->z;
 	return sqrt(dx * dx + dy * dy + dz * dz);
-	/* These are absolute rubbish, how can we combine the angle and distance in any meaningful way, why should the reduction strategy change
+	/* These are absolute rubbish how can we combine the angle and distance in any meaningful way, why should the reduction strategy change
 	 * if the model gets scaled? */
 	/* return acos(normal1[0] * normal2[0] + normal1[1] * normal2[1] + normal1[2] * normal2[2]) + sqrt(dx * dx + dy * dy + dz * dz); */
 	/* return (1.0f - (normal1[0] * normal2[0] + normal1[1] * normal2[1] + normal1[2] * normal2[2]))/2.0f + sqrt(dx * dx + dy * dy + dz * dz); */
@@ -279,20 +680,142 @@ float melaxCost(Edge *e) {
 
 
 /**
-* Garland edge removal cost..
+* Evaluate v^T Q v for the homogeneous point (x, y, z, 1).
+*/
+double quadricError(const double q[10], double x, double y, double z) {
+	return x * (q[0] * x + 2.0 * (q[1] * y + q[2] * z + q[3])) +
+		y * (q[4] * y + 2.0 * (q[5] * z + q[6])) +
+		z * (q[7] * z + 2.0 * q[8]) + q[9];
+}
+
+/**
+* Find the point minimizing the error of quadric q. Returns 0, leaving result
+* untouched, when its linear system is not well conditioned.
+*/
+int quadricMinimum(const double q[10], float result[3]) {
+	double a, b, c, d, f, g, det, scale;
+	/* Solve the symmetric system [q0 q1 q2; q1 q4 q5; q2 q5 q7] x = -[q3 q6 q8] by cofactors */
+	a = q[4] * q[7] - q[5] * q[5];
+	b = q[2] * q[5] - q[1] * q[7];
+	c = q[1] * q[5] - q[2] * q[4];
+	det = q[0] * a + q[1] * b + q[2] * c;
+	scale = MAX(fabs(q[0]), MAX(fabs(q[4]), fabs(q[7])));
+	if(!(fabs(det) > 1e-10 * scale * scale * scale)) return 0;
+	d = q[0] * q[7] - q[2] * q[2];
+	f = q[1] * q[2] - q[0] * q[5];
+	g = q[0] * q[4] - q[1] * q[1];
+	result[0] = -(a * q[3] + b * q[6] + c * q[8])/det;
+	result[1] = -(b * q[3] + d * q[6] + f * q[8])/det;
+	result[2] = -(c * q[3] + f * q[6] + g * q[8])/det;
+	return 1;
+}
+
+/**
+* Find the position minimizing the quadric error of the collapse of e, and return
+* that error. The minimizer of the summed quadric is used when its linear system is
+* well conditioned, otherwise the best of the endpoints and their midpoint is taken.
+*/
+float garlandPlacement(Edge *e, float result[3]) {
+	double q[10];
+	double error, best;
+	Vertex *v1 = e->vert;
+	Vertex *v2 = e->pair->vert;
+	int i;
+	for(i = 0; i < 10; i++) q[i] = v1->quadric[i] + v2->quadric[i];
+
+	if(quadricMinimum(q, result)) error = quadricError(q, result[0], result[1], result[2]);
+	else {
+		result[0] = (v1->x + v2->x)/2.0f;
+		result[1] = (v1->y + v2->y)/2.0f;
+		result[2] = (v1->z + v2->z)/2.0f;
+		error = quadricError(q, result[0], result[1], result[2]);
+		best = quadricError(q, v1->x, v1->y, v1->z);
+		if(best < error) {
+			error = best;
+			result[0] = v1->x;
+			result[1] = v1->y;
+			result[2] = v1->z;
+		}
+		best = quadricError(q, v2->x, v2->y, v2->z);
+		if(best < error) {
+			error = best;
+			result[0] = v2->x;
+			result[1] = v2->y;
+			result[2] = v2->z;
+		}
+	}
+	return MAX(error, 0.0);
+}
+
+/**
+* Garland edge removal cost, the quadric error at the optimal collapse position.
 */
 float garlandCost(Edge *e) {
-	__UNUSED(e);
-	return 0.0f;
+	float position[3];
+	return garlandPlacement(e, position);
+}
+
+
+/**
+* Start a new query of the per thread vertex set used by the link condition.
+* Slots remember the query they were filled in, so nothing is cleared between
+* queries unless the epoch wraps around.
+*/
+void linkBegin() {
+	linkSize = 0;
+	if(++linkEpoch == 0) {
+		memset(linkStamps, 0, sizeof(linkStamps));
+		linkEpoch = 1;
+	}
+}
+
+/**
+* Add a vertex index to the set. Returns 0 without adding it once the set is
+* half full, in which case callers fall back to comparing the rings directly.
+*/
+int linkInsert(int vertex) {
+	unsigned int slot = (((unsigned int)vertex * 2654435761u) >> 16) & (LINK_SLOTS - 1);
+	if(linkSize >= LINK_SLOTS/2) return 0;
+	while(linkStamps[slot] == linkEpoch) {
+		if(linkVerts[slot] == vertex) return 1;
+		slot = (slot + 1) & (LINK_SLOTS - 1);
+	}
+	linkStamps[slot] = linkEpoch;
+	linkVerts[slot] = vertex;
+	linkSize++;
+	return 1;
 }
 
+int linkContains(int vertex) {
+	unsigned int slot = (((unsigned int)vertex * 2654435761u) >> 16) & (LINK_SLOTS - 1);
+	while(linkStamps[slot] == linkEpoch) {
+		if(linkVerts[slot] == vertex) return 1;
+		slot = (slot + 1) & (LINK_SLOTS - 1);
+	}
+	return 0;
+}
+
+/**
+* Determine if v is the tail of one of the half edges pointing at the head of start.
+*/
+int ringContains(Edge *start, Vertex *v) {
+	Edge *ring = start;
+	do {
+		if(ring->pair->vert == v) return 1;
+		ring = ring->pair->prev;
+	} while(ring != start);
+	return 0;
+}
 
 /**
 * Determine if the edge e is collapsable without causing topology errors
 */
 int collapsable(Edge *e) {
-	Edge *ring1, *ring2;
+	Edge *ring;
+	Vertex *head = e->vert, *tail = e->pair->vert;
 	Vertex *a, *b;
+	int hashed = 1;
+	STATS_COUNT(STAT_COLLAPSABLE_CALLS);
 	/* Case (a), edge belongs to a triangle, where the other two edges are boundary edges 
 	   This shouldn't happen for manifolds */
 	//if(e->next->pair == NULL && e->prev->pair == NULL) return 0;
@@ -304,30 +827,42 @@ int collapsable(Edge *e) {
 
 	a = e->next->vert;
 	b = e->pair->next->vert;
+	
+	if(head->locked || tail->locked) {
+		STATS_COUNT(STAT_COLLAPSABLE_REJECTS);
+		return 0;
+	}
 
-	/* Consistency check for strange degenerate cases (likely mesh folding / collapse) */
-	if(a == b || e == e->pair || e->next == e->prev || e == e->next || e == e->prev ||
-		e->pair == e->pair->prev || e->pair == e->pair->next || e->pair->next == e->pair->prev ||
-		e == e->pair->next || e == e->pair->prev || e->next == e->pair || e->next == e->pair->next ||
-		e->next == e->pair->prev || e->prev == e->pair || e->prev == e->pair->next ||
-		e->prev == e->pair->prev || e->face == e->pair->face || e->vert == e->pair->vert) return 0;
+	/* Consistency check for strange degenerate cases (likely mesh folding / collapse).
+	   Two triangles on different faces over four distinct vertices cannot share or
+	   repeat any of their half edges, which covers every pairwise edge comparison */
+	if(e == e->pair || e->face == e->pair->face ||
+		e->next->next->next != e || e->pair->next->next->next != e->pair ||
+		head == tail || a == b || a == head || a == tail || b == head || b == tail) {
+		STATS_COUNT(STAT_COLLAPSABLE_REJECTS);
+		return 0;
+	}
 	
 	/* Case (c), the intersection of the one ring neighbourhoods of the incident vertices
-	   contains more than just the two incident vertices */	
-	ring1 = e;
+	   contains more than just the two incident vertices. The neighbours of the head
+	   are put in a set first, so each neighbour of the tail is checked in O(1) */
+	linkBegin();
+	ring = e;
 	do {
-		ring2 = e->pair;
-		do {
-			Vertex *v1 = ring1->pair->vert;
-			Vertex *v2 = ring2->pair->vert;
-			if(v1 == v2 && v1 != a && v1 != b) return 0;
-			
-			ring2 = ring2->pair->prev;
+		hashed = linkInsert(ring->pair->vert->index);
+		ring = ring->pair->prev;
+	} while(hashed && ring != e);
+	
+	ring = e->pair;
+	do {
+		Vertex *v = ring->pair->vert;
+		if(v != a && v != b && (hashed ? linkContains(v->index) : ringContains(e, v))) {
+			STATS_COUNT(STAT_COLLAPSABLE_REJECTS);
+			return 0;
 		}
-		while(ring2 != e->pair);
-		ring1 = ring1->pair->prev;
+		ring = ring->pair->prev;
 	}
-	while(ring1 != e);
+	while(ring != e->pair);
 	
 	return 1;
 }
@@ -335,13 +870,21 @@ int collapsable(Edge *e) {
 int reduce(Mesh *m) {
 	Edge *e;
 	Vertex *v;
+	STATS_START(start);
 	
+	if(m->recorder != NULL) resumeRecording(m);
 	e = removeMin(m->heap);
 	if(e == NULL) return 0;
 	
-	v = collapseEdge(m, e);
-	localDelaunay(v);
+	if(m->recorder != NULL) v = recordCollapse(m, e);
+	else {
+		v = collapseEdge(m, e);
+		localDelaunay(v, NULL);
+	}
+	logVertex(m, v);
 	recalculate(m, v);
+	STATS_COUNT(STAT_COLLAPSES);
+	STATS_LATENCY(LATENCY_COLLAPSE, start);
 	
 #ifdef DEBUG
 	if(!verifyHeap(m->heap)) {
@@ -352,6 +895,49 @@ int reduce(Mesh *m) {
 }
 
 Vertex *collapseEdge(Mesh *m, Edge *e) {
+	Vertex *p = contractEdge(m, e);
+	removeContracted(m, e);
+	return p;
+}
+
+/**
+* Relink the mesh around e so that its tail vertex absorbs its head vertex,
+* without deleting the elements that are cut out. Only elements in the closed
+* 1-rings of the two endpoints are written, so contractions with disjoint
+* neighbourhoods may run concurrently. removeContracted must follow.
+*/
+Vertex *contractEdge(Mesh *m, Edge *e) {
+	float position[3];
+	Vertex *p = e->pair->vert;
+	if(m->heap->func == garlandCost) garlandPlacement(e, position);
+	else {
+		position[0] = (p->x + e->vert->x)/2.0f;
+		position[1] = (p->y + e->vert->y)/2.0f;
+		position[2] = (p->z + e->vert->z)/2.0f;
+	}
+	return contractEdgeTo(e, position);
+}
+
+/**
+* Find which of the conditional pointer moves of contractEdgeTo(e) will happen,
+* as a set of CONTRACT_* bits. Call before contracting.
+*/
+unsigned char contractLinks(Edge *e) {
+	Edge *b1 = e->next;
+	Edge *d2 = e->pair->prev->pair;
+	unsigned char links = 0;
+	if(b1->pair->face->edge == b1->pair) links |= CONTRACT_LEFT_FACE;
+	if(b1->vert->edge == b1) links |= CONTRACT_LEFT_VERT;
+	if(d2->face->edge == d2) links |= CONTRACT_RIGHT_FACE;
+	if(e->pair->next->vert->edge == d2) links |= CONTRACT_RIGHT_VERT;
+	if(e->pair->vert->edge == e->pair) links |= CONTRACT_TAIL;
+	return links;
+}
+
+/**
+* Contract e as contractEdge does, moving the surviving vertex to position.
+*/
+Vertex *contractEdgeTo(Edge *e, const float position[3]) {
 	Edge *edge;
 	Vertex *p;
 	
@@ -362,6 +948,7 @@ Vertex *collapseEdge(Mesh *m, Edge *e) {
 	Edge *b2 = b1->pair;
 	Edge *d1 = e->pair->prev;
 	Edge *d2 = d1->pair;
+	STATS_START(start);
 	
 	p = e->pair->vert;
 	/* Re link vertex of edges incident at Q to P */
@@ -393,10 +980,47 @@ Vertex *collapseEdge(Mesh *m, Edge *e) {
 	p = e->pair->vert;
 	if(p->edge == e->pair) p->edge = a;
 	
-	p->x = (p->x + e->vert->x)/2.0f;
-	p->y = (p->y + e->vert->y)/2.0f;
-	p->z = (p->z + e->vert->z)/2.0f;
+	p->x = position[0];
+	p->y = position[1];
+	p->z = position[2];
+	p->snapshot = -1;
+	for(int i = 0; i < 10; i++) p->quadric[i] += e->vert->quadric[i];
 	
+	/* P moved, so every face around it needs a new normal */
+	edge = p->edge;
+	do {
+		edge->face->stale = 1;
+		edge = edge->pair->prev;
+	} while(edge != p->edge);
+	
+	STATS_PHASE(PHASE_CONTRACT, start);
+	return p;
+}
+
+/**
+* Delete the elements cut out of the mesh by contractEdge(m, e). While recording
+* they are only detached, so the collapse can be undone.
+*/
+void removeContracted(Mesh *m, Edge *e) {
+	Edge *b1 = e->next;
+	Edge *b2 = b1->pair;
+	Edge *d1 = e->pair->prev;
+	Edge *d2 = d1->pair;
+	STATS_START(start);
+	
+	if(m->recorder != NULL) {
+		detachEdge(m, b1);
+		detachEdge(m, d1);
+		detachEdge(m, b2);
+		detachEdge(m, d2);
+		detachFace(m, e->face);
+		detachFace(m, e->pair->face);
+		detachVert(m, e->vert);
+		detachEdge(m, e->pair);
+		detachEdge(m, e);
+		STATS_PHASE(PHASE_CONTRACT, start);
+		return;
+	}
 	deleteEdge(m, b1);
 	deleteEdge(m, d1);
 	deleteEdge(m, b2);
@@ -406,6 +1030,214 @@ Vertex *collapseEdge(Mesh *m, Edge *e) {
 	deleteVert(m, e->vert);
 	deleteEdge(m, e->pair);
 	deleteEdge(m, e);
+	STATS_PHASE(PHASE_CONTRACT, start);
+}
+
+/**
+* Claim the closed 1-rings of both endpoints of e for the current epoch. Returns 0
+* without claiming anything if a vertex was already claimed.
+*/
+int claimRegion(Mesh *m, Edge *e) {
+	Edge *start[2], *ring;
+	int i, pass;
+	start[0] = e;
+	start[1] = e->pair;
+	for(pass = 0; pass < 2; pass++) {
+		for(i = 0; i < 2; i++) {
+			ring = start[i];
+			do {
+				if(pass == 0 && ring->pair->vert->stamp == m->epoch) return 0;
+				if(pass == 1) ring->pair->vert->stamp = m->epoch;
+				ring = ring->pair->prev;
+			} while(ring != start[i]);
+		}
+	}
+	return 1;
+}
+
+typedef struct _roundjob {
+	Mesh *m;
+	Edge **edges;
+	Vertex **verts;
+	char *valid;
+	float *costs;
+	CollapseRecord *records; /* Record slot and flip log of every collapse when recording */
+	FlipLog *flips;
+} RoundJob;
+
+void contractRange(void *arg, int start, int end) {
+	RoundJob *job = (RoundJob*)arg;
+	int i;
+	for(i = start; i < end; i++) {
+		if(job->records != NULL) {
+			job->verts[i] = contractRecorded(job->m, job->edges[i], &job->records[i], &job->flips[i]);
+		}
+		else {
+			job->verts[i] = contractEdge(job->m, job->edges[i]);
+			localDelaunay(job->verts[i], NULL);
+		}
+		refreshNormals(job->verts[i]);
+	}
+}
+
+void evaluateRange(void *arg, int start, int end) {
+	RoundJob *job = (RoundJob*)arg;
+	Heap *h = job->m->heap;
+	int i;
+	STATS_START(timer);
+	for(i = start; i < end; i++) {
+		job->valid[i] = (char)(*h->test)(job->edges[i]);
+		job->costs[i] = job->valid[i] ? (*h->func)(job->edges[i]) : 0.0f;
+		if(job->valid[i]) STATS_COUNT(STAT_COST_CALLS);
+	}
+	STATS_PHASE(PHASE_REKEY, timer);
+}
+
+/**
+* Perform one round of parallel reduction. Up to maxCollapses of the cheapest
+* edges costing at most maxCost whose endpoint 1-rings are pairwise disjoint are
+* taken from the heap and contracted on meshThreads threads, followed by their
+* local Delaunay flips. The cut out elements are then deleted, and the keys of
+* the union of the 2-rings of the surviving vertices are evaluated in parallel
+* and applied to the heap.
+* Selection is serial and the contractions touch disjoint regions, so the result
+* does not depend on thread scheduling. Returns the number of edges collapsed.
+*/
+int reduceRound(Mesh *m, int maxCollapses, float maxCost) {
+	Heap *h = m->heap;
+	RoundJob job;
+	Edge **skipped;
+	float *skippedCost;
+	int count = 0, numSkipped = 0, maxPops = 4 * maxCollapses + 64;
+	int i;
+	STATS_START(start);
 	
-	return p;
+	if(m->recorder != NULL) resumeRecording(m);
+	if(maxCollapses < 1 || h->size == 0) return 0;
+	job.m = m;
+	job.records = NULL;
+	job.flips = NULL;
+	job.edges = (Edge**)malloc(maxCollapses * sizeof(Edge*));
+	job.verts = (Vertex**)malloc(maxCollapses * sizeof(Vertex*));
+	skipped = (Edge**)malloc(maxPops * sizeof(Edge*));
+	skippedCost = (float*)malloc(maxPops * sizeof(float));
+	
+	/* Select independent edges, putting back the ones that overlap a selected region */
+	clearDirty(m);
+	while(count < maxCollapses && h->size > 0 && count + numSkipped < maxPops) {
+		float cost = heapMinCost(h);
+		Edge *e;
+		if(cost > maxCost) break;
+		e = removeMin(h);
+		if(claimRegion(m, e)) job.edges[count++] = e;
+		else {
+			skipped[numSkipped] = e;
+			skippedCost[numSkipped++] = cost;
+		}
+	}
+	for(i = 0; i < numSkipped; i++) updateKey(h, skipped[i], skippedCost[i]);
+	free(skipped);
+	free(skippedCost);
+	
+	if(m->recorder != NULL) {
+		job.records = reserveRecords(m, count);
+		job.flips = (FlipLog*)calloc(count + 1, sizeof(FlipLog));
+	}
+	parallelFor(count, meshThreads, contractRange, &job);
+	if(m->recorder != NULL) {
+		commitRecords(m, count, job.flips);
+		free(job.flips);
+	}
+	for(i = 0; i < count; i++) removeContracted(m, job.edges[i]);
+	for(i = 0; i < count; i++) logVertex(m, job.verts[i]);
+	
+	clearDirty(m);
+	for(i = 0; i < count; i++) gatherDirty(m, job.verts[i]);
+	job.edges = (Edge**)realloc(job.edges, (m->numDirty + 1) * sizeof(Edge*));
+	memcpy(job.edges, m->dirty, m->numDirty * sizeof(Edge*));
+	/* The costs may read normals beyond the refreshed regions, left stale by serial collapses or replays */
+	for(i = 0; i < m->numDirty; i++) refreshRing(m->dirty[i]->vert);
+	job.valid = (char*)malloc(m->numDirty + 1);
+	job.costs = (float*)malloc((m->numDirty + 1) * sizeof(float));
+	parallelFor(m->numDirty, meshThreads, evaluateRange, &job);
+	for(i = 0; i < m->numDirty; i++) {
+		if(job.valid[i]) updateKey(h, job.edges[i], job.costs[i]);
+		else removeEdge(h, job.edges[i]);
+	}
+	m->rekeyed += m->numDirty;
+	STATS_COUNT(STAT_ROUNDS);
+	STATS_ADD(STAT_COLLAPSES, count);
+	STATS_LATENCY(LATENCY_ROUND, start);
+	
+	free(job.edges);
+	free(job.verts);
+	free(job.valid);
+	free(job.costs);
+	
+#ifdef DEBUG
+	if(!verifyHeap(m->heap)) {
+		printf("Heap consistency error!\n");
+	}
+#endif
+	return count;
+}
+
+/**
+* Collapse edges until at most targetFaces faces or targetEdges half edges remain.
+* Collapses are done one at a time, or in parallel rounds if rounds is set.
+* Returns the number of collapses done.
+*/
+int reduceTo(Mesh *mesh, int targetFaces, int targetEdges, int rounds) {
+	ReduceLimits limits;
+	int collapses;
+	limits.targetFaces = targetFaces;
+	limits.targetEdges = targetEdges;
+	limits.maxCost = INFINITY;
+	limits.budget = 0;
+	limits.rounds = rounds;
+	reduceUntil(mesh, &limits, &collapses);
+	return collapses;
+}
+
+/**
+* Collapse edges until the first of the limits is met, storing the collapses done
+* in *collapses unless it is NULL. Every collapse leaves the mesh and heap
+* consistent, so calling again with a fresh budget carries on where the last
+* call stopped, which lets an interactive loop reduce in slices of bounded
+* latency. The clock is read after every collapse or round, so the budget is
+* overrun by at most one of them. Returns the REDUCE_* reason for stopping.
+*/
+int reduceUntil(Mesh *mesh, const ReduceLimits *limits, int *collapses) {
+	unsigned long long deadline = statsNow() + 1000ull * (unsigned long long)limits->budget;
+	int count = 0, reason;
+	
+	if(mesh->recorder != NULL) resumeRecording(mesh);
+	for(;;) {
+		int done;
+		if(mesh->numFaces <= limits->targetFaces || mesh->numEdges <= limits->targetEdges) {
+			reason = REDUCE_TARGET;
+			break;
+		}
+		if(heapMinCost(mesh->heap) > limits->maxCost) {
+			reason = mesh->heap->size == 0 ? REDUCE_STUCK : REDUCE_COST;
+			break;
+		}
+		if(limits->rounds) {
+			/* Each collapse removes two faces and six half edges */
+			int remaining = MIN((mesh->numFaces - limits->targetFaces + 1)/2, (mesh->numEdges - limits->targetEdges + 5)/6);
+			done = reduceRound(mesh, MIN(remaining, MAX(ROUND_MIN, mesh->numFaces/ROUND_DIVISOR)), limits->maxCost);
+		}
+		else done = reduce(mesh);
+		if(!done) {
+			reason = REDUCE_STUCK;
+			break;
+		}
+		count += done;
+		if(limits->budget > 0 && statsNow() >= deadline) {
+			reason = REDUCE_TIME;
+			break;
+		}
+	}
+	if(collapses != NULL) *collapses = count;
+	return reason;
 }
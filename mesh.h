@@ -3,29 +3,94 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include "types.h"
 #include "heap.h"
+#include "pool.h"
 
-Mesh* initMesh(int numVertices, int numFaces, int numEdges, Vertex **verts, Face **faces, Edge **edges);
+extern int meshThreads; /* Worker threads used by the parallel passes */
+extern int deferHeap; /* Leave the heap of newly built meshes empty until changeCostFunc */
+
+/* Conditional pointer moves done by contractEdgeTo, see contractLinks */
+#define CONTRACT_LEFT_FACE 1
+#define CONTRACT_LEFT_VERT 2
+#define CONTRACT_RIGHT_FACE 4
+#define CONTRACT_RIGHT_VERT 8
+#define CONTRACT_TAIL 16
+
+/* Why reduceUntil returned */
+#define REDUCE_TARGET 0 /* The face or half edge target was reached */
+#define REDUCE_COST 1 /* The cheapest edge left costs more than maxCost */
+#define REDUCE_TIME 2 /* The time budget ran out */
+#define REDUCE_STUCK 3 /* No edge left can be collapsed */
+
+/**
+* Stop conditions for reduceUntil, the first one met ends the reduction. Set
+* maxCost to INFINITY and budget to 0 to leave them out.
+*/
+typedef struct _reducelimits {
+	int targetFaces, targetEdges; /* Stop once at most this many faces or half edges remain */
+	float maxCost; /* Stop before collapsing an edge costing more than this */
+	long budget; /* Microseconds of wall time, or 0 for no limit */
+	int rounds; /* Collapse in parallel rounds, with the time budget checked between rounds */
+} ReduceLimits;
+
+Mesh* initMesh(int numVertices, int numFaces, int numEdges);
+void buildMesh(Mesh *m);
 void destroyMesh(Mesh *m);
 
+Vertex *newVertex(Mesh *m);
+Edge *newEdge(Mesh *m);
+Face *newFace(Mesh *m);
+
 void faceNormal(Face *f, float result[3]);
+void updateNormal(Face *f);
+void refreshRing(Vertex *v);
+void refreshNormals(Vertex *v);
+void refreshStaleNormals(Mesh *m);
+void computeQuadrics(Mesh *m);
 
 void deleteVert(Mesh *m, Vertex *v);
 void deleteEdge(Mesh *m, Edge *e);
 void deleteFace(Mesh *m, Face *f);
+void detachVert(Mesh *m, Vertex *v);
+void detachEdge(Mesh *m, Edge *e);
+void detachFace(Mesh *m, Face *f);
+void restoreVert(Mesh *m, Vertex *v);
+void restoreEdge(Mesh *m, Edge *e);
+void restoreFace(Mesh *m, Face *f);
+void logVertex(Mesh *m, Vertex *v);
+void logFace(Mesh *m, Face *f);
 
 void edgeFlip(Edge *e);
-void localDelaunay(Vertex *e);
+void saveFlip(Edge *e, FlipRecord *r);
+void undoFlip(const FlipRecord *r);
+void localDelaunay(Vertex *v, FlipLog *log);
 void recalculate(Mesh *m, Vertex *v);
+void gatherDirty(Mesh *m, Vertex *v);
+void markDirty(Mesh *m, Edge *e);
+void clearDirty(Mesh *m);
 
 void changeCostFunc(Mesh *m, float (*func)(Edge*));
 float simpleCost(Edge *e);
 float melaxCost(Edge *e);
 float garlandCost(Edge *e);
+int quadricMinimum(const double q[10], float result[3]);
+float garlandPlacement(Edge *e, float result[3]);
 
+void linkBegin();
+int linkInsert(int vertex);
+int linkContains(int vertex);
+int ringContains(Edge *start, Vertex *v);
 int collapsable(Edge *e);
 int reduce(Mesh *m);
+int reduceRound(Mesh *m, int maxCollapses, float maxCost);
+int reduceTo(Mesh *mesh, int targetFaces, int targetEdges, int rounds);
+int reduceUntil(Mesh *mesh, const ReduceLimits *limits, int *collapses);
 Vertex *collapseEdge(Mesh *m, Edge *e);
+Vertex *contractEdge(Mesh *m, Edge *e);
+Vertex *contractEdgeTo(Edge *e, const float position[3]);
+unsigned char contractLinks(Edge *e);
+void removeContracted(Mesh *m, Edge *e);
 
 #endif
@@ -0,0 +1,264 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "meshcache.h"
+
+#define ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+CompactMesh *initCompactMesh(int numVertices, int numFaces, int numEdges) {
+	CompactMesh *c = (CompactMesh*)malloc(sizeof(CompactMesh));
+	c->numVertices = numVertices;
+	c->numFaces = numFaces;
+	c->numEdges = numEdges;
+	c->next = (uint32_t*)malloc(numEdges * sizeof(uint32_t));
+	c->prev = (uint32_t*)malloc(numEdges * sizeof(uint32_t));
+	c->pair = (uint32_t*)malloc(numEdges * sizeof(uint32_t));
+	c->vert = (uint32_t*)malloc(numEdges * sizeof(uint32_t));
+	c->face = (uint32_t*)malloc(numEdges * sizeof(uint32_t));
+	c->vertEdge = (uint32_t*)malloc(numVertices * sizeof(uint32_t));
+	c->faceEdge = (uint32_t*)malloc(numFaces * sizeof(uint32_t));
+	c->positions = (float*)malloc(3 * numVertices * sizeof(float));
+	c->mapping = NULL;
+	c->mappingSize = 0;
+	return c;
+}
+
+void destroyCompactMesh(CompactMesh *c) {
+	if(c->mapping != NULL) {
+		munmap(c->mapping, c->mappingSize);
+		free(c);
+		return;
+	}
+	free(c->next);
+	free(c->prev);
+	free(c->pair);
+	free(c->vert);
+	free(c->face);
+	free(c->vertEdge);
+	free(c->faceEdge);
+	free(c->positions);
+	free(c);
+}
+
+/**
+* Convert a pointer linked mesh into structure of arrays form. Element
+* indices are taken from the index fields of the mesh elements.
+*/
+CompactMesh *packMesh(Mesh *m) {
+	CompactMesh *c = initCompactMesh(m->numVertices, m->numFaces, m->numEdges);
+	int i;
+	for(i = 0; i < m->numEdges; i++) {
+		Edge *e = m->edges[i];
+		c->next[i] = e->next->index;
+		c->prev[i] = e->prev->index;
+		c->pair[i] = e->pair == NULL ? COMPACT_NONE : (uint32_t)e->pair->index;
+		c->vert[i] = e->vert->index;
+		c->face[i] = e->face->index;
+	}
+	for(i = 0; i < m->numVertices; i++) {
+		Vertex *v = m->verts[i];
+		c->vertEdge[i] = v->edge == NULL ? COMPACT_NONE : (uint32_t)v->edge->index;
+		c->positions[3 * i] = v->x;
+		c->positions[3 * i + 1] = v->y;
+		c->positions[3 * i + 2] = v->z;
+	}
+	for(i = 0; i < m->numFaces; i++) c->faceEdge[i] = m->faces[i]->edge->index;
+	return c;
+}
+
+/**
+* Build a pointer linked mesh, including its edge heap, from structure of arrays form.
+*/
+Mesh *unpackMesh(CompactMesh *c) {
+	Mesh *m = initMesh(c->numVertices, c->numFaces, c->numEdges);
+	Vertex **verts = m->verts;
+	Face **faces = m->faces;
+	Edge **edges = m->edges;
+	int i;
+	for(i = 0; i < c->numVertices; i++) {
+		verts[i] = newVertex(m);
+		verts[i]->index = i;
+		verts[i]->x = c->positions[3 * i];
+		verts[i]->y = c->positions[3 * i + 1];
+		verts[i]->z = c->positions[3 * i + 2];
+	}
+	for(i = 0; i < c->numFaces; i++) {
+		faces[i] = newFace(m);
+		faces[i]->index = i;
+	}
+	for(i = 0; i < c->numEdges; i++) {
+		edges[i] = newEdge(m);
+		edges[i]->index = i;
+	}
+	for(i = 0; i < c->numEdges; i++) {
+		Edge *e = edges[i];
+		e->next = edges[c->next[i]];
+		e->prev = edges[c->prev[i]];
+		e->pair = c->pair[i] == COMPACT_NONE ? NULL : edges[c->pair[i]];
+		e->vert = verts[c->vert[i]];
+		e->face = faces[c->face[i]];
+	}
+	for(i = 0; i < c->numVertices; i++) verts[i]->edge = c->vertEdge[i] == COMPACT_NONE ? NULL : edges[c->vertEdge[i]];
+	for(i = 0; i < c->numFaces; i++) faces[i]->edge = edges[c->faceEdge[i]];
+	buildMesh(m);
+	return m;
+}
+
+/**
+* Byte offsets of the cache arrays, in file order, followed by the total file size.
+*/
+void cacheLayout(uint32_t numVertices, uint32_t numFaces, uint32_t numEdges, size_t offsets[9]) {
+	size_t sizes[8];
+	int i;
+	sizes[0] = 3 * (size_t)numVertices * sizeof(float);
+	for(i = 1; i <= 5; i++) sizes[i] = (size_t)numEdges * sizeof(uint32_t);
+	sizes[6] = (size_t)numVertices * sizeof(uint32_t);
+	sizes[7] = (size_t)numFaces * sizeof(uint32_t);
+	offsets[0] = ALIGN(sizeof(CacheHeader));
+	for(i = 1; i <= 8; i++) offsets[i] = ALIGN(offsets[i - 1] + sizes[i - 1]);
+}
+
+/**
+* Write c to fileName in the binary cache format, stamped with the size and
+* modification time of its source file. The file is written under a temporary
+* name and renamed into place so concurrent readers never see a partial cache.
+* Returns 1 on success.
+*/
+int writeMeshCache(CompactMesh *c, char *fileName, struct stat *source) {
+	CacheHeader header;
+	size_t offsets[9];
+	void *arrays[8];
+	size_t sizes[8];
+	char *tempName;
+	char padding[8] = {0};
+	FILE *f;
+	int i, ok = 1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = CACHE_VERSION;
+	header.byteOrder = CACHE_BYTE_ORDER;
+	header.numVertices = c->numVertices;
+	header.numFaces = c->numFaces;
+	header.numEdges = c->numEdges;
+	header.sourceSize = source->st_size;
+	header.sourceSec = source->st_mtim.tv_sec;
+	header.sourceNsec = source->st_mtim.tv_nsec;
+	cacheLayout(header.numVertices, header.numFaces, header.numEdges, offsets);
+
+	arrays[0] = c->positions;
+	arrays[1] = c->next;
+	arrays[2] = c->prev;
+	arrays[3] = c->pair;
+	arrays[4] = c->vert;
+	arrays[5] = c->face;
+	arrays[6] = c->vertEdge;
+	arrays[7] = c->faceEdge;
+	sizes[0] = 3 * (size_t)c->numVertices * sizeof(float);
+	for(i = 1; i <= 5; i++) sizes[i] = (size_t)c->numEdges * sizeof(uint32_t);
+	sizes[6] = (size_t)c->numVertices * sizeof(uint32_t);
+	sizes[7] = (size_t)c->numFaces * sizeof(uint32_t);
+
+	tempName = (char*)malloc(strlen(fileName) + 32);
+	sprintf(tempName, "%s.%ld.tmp", fileName, (long)getpid());
+	f = fopen(tempName, "wb");
+	if(f == NULL) {
+		free(tempName);
+		return 0;
+	}
+	ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(padding, 1, offsets[0] - sizeof(header), f) == offsets[0] - sizeof(header);
+	for(i = 0; i < 8 && ok; i++) {
+		ok = fwrite(arrays[i], 1, sizes[i], f) == sizes[i];
+		ok = ok && fwrite(padding, 1, offsets[i + 1] - offsets[i] - sizes[i], f) == offsets[i + 1] - offsets[i] - sizes[i];
+	}
+	ok = fclose(f) == 0 && ok;
+	if(ok) ok = rename(tempName, fileName) == 0;
+	if(!ok) remove(tempName);
+	free(tempName);
+	return ok;
+}
+
+/**
+* Determine if every index of c is in range and the next, prev and pair links
+* are consistent, so that a damaged cache cannot make unpackMesh or the walks
+* over the mesh leave the arrays.
+*/
+int cacheValid(CompactMesh *c) {
+	uint32_t numEdges = c->numEdges, i;
+	for(i = 0; i < numEdges; i++) {
+		if(c->next[i] >= numEdges || c->prev[i] >= numEdges ||
+				c->vert[i] >= (uint32_t)c->numVertices || c->face[i] >= (uint32_t)c->numFaces) return 0;
+		if(c->prev[c->next[i]] != i || c->next[c->next[c->next[i]]] != i) return 0;
+		if(c->pair[i] != COMPACT_NONE && (c->pair[i] >= numEdges || c->pair[c->pair[i]] != i)) return 0;
+	}
+	for(i = 0; i < (uint32_t)c->numVertices; i++) {
+		if(c->vertEdge[i] != COMPACT_NONE && (c->vertEdge[i] >= numEdges || c->vert[c->vertEdge[i]] != i)) return 0;
+	}
+	for(i = 0; i < (uint32_t)c->numFaces; i++) {
+		if(c->faceEdge[i] >= numEdges || c->face[c->faceEdge[i]] != i) return 0;
+	}
+	return 1;
+}
+
+/**
+* Map a binary cache built from the file described by source and return a
+* CompactMesh whose arrays point straight into the mapping. The mapping is
+* private, so the arrays may be modified in place without touching the file.
+* Returns NULL if the file is missing, truncated, corrupt, was written by an
+* incompatible version or for a source of another size or modification time.
+*/
+CompactMesh *mapMeshCache(char *fileName, struct stat *source) {
+	CompactMesh *c;
+	CacheHeader header;
+	size_t offsets[9];
+	struct stat info;
+	char *data;
+	int fd = open(fileName, O_RDONLY);
+	if(fd < 0) return NULL;
+	if(fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(CacheHeader) ||
+			read(fd, &header, sizeof(header)) != sizeof(header) ||
+			memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) ||
+			header.version != CACHE_VERSION || header.byteOrder != CACHE_BYTE_ORDER ||
+			header.sourceSize != (uint64_t)source->st_size || header.sourceSec != (int64_t)source->st_mtim.tv_sec ||
+			header.sourceNsec != (uint32_t)source->st_mtim.tv_nsec ||
+			header.numVertices > INT_MAX || header.numFaces > INT_MAX || header.numEdges > INT_MAX) {
+		close(fd);
+		return NULL;
+	}
+	cacheLayout(header.numVertices, header.numFaces, header.numEdges, offsets);
+	if((size_t)info.st_size != offsets[8]) {
+		close(fd);
+		return NULL;
+	}
+	data = (char*)mmap(NULL, offsets[8], PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) return NULL;
+
+	c = (CompactMesh*)malloc(sizeof(CompactMesh));
+	c->numVertices = header.numVertices;
+	c->numFaces = header.numFaces;
+	c->numEdges = header.numEdges;
+	c->positions = (float*)(data + offsets[0]);
+	c->next = (uint32_t*)(data + offsets[1]);
+	c->prev = (uint32_t*)(data + offsets[2]);
+	c->pair = (uint32_t*)(data + offsets[3]);
+	c->vert = (uint32_t*)(data + offsets[4]);
+	c->face = (uint32_t*)(data + offsets[5]);
+	c->vertEdge = (uint32_t*)(data + offsets[6]);
+	c->faceEdge = (uint32_t*)(data + offsets[7]);
+	c->mapping = data;
+	c->mappingSize = offsets[8];
+	if(!cacheValid(c)) {
+		munmap(data, offsets[8]);
+		free(c);
+		return NULL;
+	}
+	return c;
+}
@@ -0,0 +1,62 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "types.h"
+#include "mesh.h"
+
+#define CACHE_MAGIC "MESHBIN"
+#define CACHE_VERSION 2
+#define CACHE_EXTENSION ".mbin"
+#define COMPACT_NONE 0xFFFFFFFFu /* Missing pair or vertex edge */
+
+/**
+* Packed structure of arrays form of a half edge mesh, as stored in the cache.
+* It is only used to write and map caches, meshes are always reduced in their
+* pointer form. Every half edge is described by 32 bit indices into the
+* parallel next/prev/pair/vert/face arrays (20 bytes per half edge), and
+* positions are packed xyz triples. Conventions follow the pointer mesh:
+* vert is the vertex the half edge points to, vertEdge is a half edge pointing
+* to the vertex and faceEdge is any half edge of the face.
+*/
+typedef struct _compactmesh {
+	int numEdges, numVertices, numFaces;
+	uint32_t *next, *prev, *pair, *vert, *face;
+	uint32_t *vertEdge;
+	uint32_t *faceEdge;
+	float *positions;
+	void *mapping; /* Mapped cache file backing the arrays, or NULL if they are allocated */
+	size_t mappingSize;
+} CompactMesh;
+
+/**
+* Header of a binary mesh cache. It is followed by the CompactMesh arrays in
+* the order positions, next, prev, pair, vert, face, vertEdge, faceEdge, each
+* starting at an offset that is a multiple of 8 bytes. The size and
+* modification time of the OFF file it was built from are recorded so that a
+* cache is only used for exactly that file.
+*/
+typedef struct _cacheheader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder; /* CACHE_BYTE_ORDER as written by the producing machine */
+	uint32_t numVertices, numFaces, numEdges;
+	uint32_t sourceNsec; /* Modification time of the source file, nanoseconds part */
+	uint64_t sourceSize;
+	int64_t sourceSec; /* Modification time of the source file, seconds part */
+	uint32_t reserved[4];
+} CacheHeader;
+
+#define CACHE_BYTE_ORDER 0x01020304u
+
+CompactMesh *initCompactMesh(int numVertices, int numFaces, int numEdges);
+void destroyCompactMesh(CompactMesh *c);
+CompactMesh *packMesh(Mesh *m);
+Mesh *unpackMesh(CompactMesh *c);
+
+int writeMeshCache(CompactMesh *c, char *fileName, struct stat *source);
+CompactMesh *mapMeshCache(char *fileName, struct stat *source);
+
+#endif
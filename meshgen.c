@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+/**
+* Generator of closed manifold test meshes of chosen size, written as OFF.
+* Icospheres are subdivided icosahedra with 20 * 4^level faces, tori are
+* regular grids optionally displaced along their normals by seeded noise.
+*/
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MIDPOINT_EMPTY UINT64_MAX
+#define GOLDEN 1.6180339887f
+
+typedef struct _midpoints {
+	uint64_t *keys; /* Packed (min, max) endpoint pair of an edge */
+	uint32_t *values; /* Vertex created at the middle of that edge */
+	size_t capacity;
+} Midpoints;
+
+void usage(char *name) {
+	printf("Usage: %s icosphere level output.off\n", name);
+	printf("       %s torus faces output.off [noise]\n", name);
+	printf("The torus gets at least the given number of faces, noise is relative to its tube radius.\n");
+}
+
+void writeOff(char *fileName, float *positions, uint32_t numVertices, uint32_t *faces, uint32_t numFaces) {
+	FILE *f = fopen(fileName, "w");
+	uint32_t i;
+	if(f == NULL) {
+		printf("Could not open file %s for writing.\n", fileName);
+		exit(2);
+	}
+	fprintf(f, "OFF\n%u %u 0\n", numVertices, numFaces);
+	for(i = 0; i < numVertices; i++) {
+		fprintf(f, "%.7g %.7g %.7g\n", positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+	}
+	for(i = 0; i < numFaces; i++) fprintf(f, "3 %u %u %u\n", faces[3 * i], faces[3 * i + 1], faces[3 * i + 2]);
+	fclose(f);
+}
+
+/**
+* Return the vertex in the middle of edge (a, b), creating it on the unit sphere if needed.
+*/
+uint32_t midpoint(Midpoints *table, float *positions, uint32_t *numVertices, uint32_t a, uint32_t b) {
+	uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+	size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 17) & (table->capacity - 1);
+	float *p, len;
+	while(table->keys[slot] != MIDPOINT_EMPTY) {
+		if(table->keys[slot] == key) return table->values[slot];
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+	table->keys[slot] = key;
+	table->values[slot] = *numVertices;
+	p = positions + 3 * (size_t)*numVertices;
+	p[0] = positions[3 * a] + positions[3 * b];
+	p[1] = positions[3 * a + 1] + positions[3 * b + 1];
+	p[2] = positions[3 * a + 2] + positions[3 * b + 2];
+	len = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+	p[0] /= len;
+	p[1] /= len;
+	p[2] /= len;
+	return (*numVertices)++;
+}
+
+void icosphere(int level, char *fileName) {
+	static const float base[12][3] = {
+		{-1, GOLDEN, 0}, {1, GOLDEN, 0}, {-1, -GOLDEN, 0}, {1, -GOLDEN, 0},
+		{0, -1, GOLDEN}, {0, 1, GOLDEN}, {0, -1, -GOLDEN}, {0, 1, -GOLDEN},
+		{GOLDEN, 0, -1}, {GOLDEN, 0, 1}, {-GOLDEN, 0, -1}, {-GOLDEN, 0, 1}
+	};
+	static const uint32_t baseFaces[20][3] = {
+		{0, 11, 5}, {0, 5, 1}, {0, 1, 7}, {0, 7, 10}, {0, 10, 11},
+		{1, 5, 9}, {5, 11, 4}, {11, 10, 2}, {10, 7, 6}, {7, 1, 8},
+		{3, 9, 4}, {3, 4, 2}, {3, 2, 6}, {3, 6, 8}, {3, 8, 9},
+		{4, 9, 5}, {2, 4, 11}, {6, 2, 10}, {8, 6, 7}, {9, 8, 1}
+	};
+	uint32_t numFaces = 20, numVertices = 12, maxFaces, maxVertices, i;
+	uint32_t *faces, *next;
+	float *positions;
+	Midpoints table;
+	int l;
+
+	maxFaces = 20;
+	for(l = 0; l < level; l++) maxFaces *= 4;
+	maxVertices = maxFaces/2 + 2;
+	positions = (float*)malloc(3 * (size_t)maxVertices * sizeof(float));
+	faces = (uint32_t*)malloc(3 * (size_t)maxFaces * sizeof(uint32_t));
+	next = (uint32_t*)malloc(3 * (size_t)maxFaces * sizeof(uint32_t));
+	for(i = 0; i < 12; i++) {
+		float len = sqrt(base[i][0] * base[i][0] + base[i][1] * base[i][1] + base[i][2] * base[i][2]);
+		positions[3 * i] = base[i][0]/len;
+		positions[3 * i + 1] = base[i][1]/len;
+		positions[3 * i + 2] = base[i][2]/len;
+	}
+	memcpy(faces, baseFaces, sizeof(baseFaces));
+
+	/* Each level adds one vertex per edge, so the table never fills past half */
+	for(table.capacity = 1; table.capacity < 2 * (size_t)maxFaces; table.capacity *= 2);
+	table.keys = (uint64_t*)malloc(table.capacity * sizeof(uint64_t));
+	table.values = (uint32_t*)malloc(table.capacity * sizeof(uint32_t));
+	for(l = 0; l < level; l++) {
+		uint32_t *swap;
+		memset(table.keys, 0xFF, table.capacity * sizeof(uint64_t));
+		for(i = 0; i < numFaces; i++) {
+			uint32_t a = faces[3 * i], b = faces[3 * i + 1], c = faces[3 * i + 2];
+			uint32_t ab = midpoint(&table, positions, &numVertices, a, b);
+			uint32_t bc = midpoint(&table, positions, &numVertices, b, c);
+			uint32_t ca = midpoint(&table, positions, &numVertices, c, a);
+			uint32_t *out = next + 12 * (size_t)i;
+			out[0] = a; out[1] = ab; out[2] = ca;
+			out[3] = b; out[4] = bc; out[5] = ab;
+			out[6] = c; out[7] = ca; out[8] = bc;
+			out[9] = ab; out[10] = bc; out[11] = ca;
+		}
+		numFaces *= 4;
+		swap = faces;
+		faces = next;
+		next = swap;
+	}
+	writeOff(fileName, positions, numVertices, faces, numFaces);
+	printf("Wrote %u vertices and %u faces to %s.\n", numVertices, numFaces, fileName);
+	free(table.keys);
+	free(table.values);
+	free(positions);
+	free(faces);
+	free(next);
+}
+
+void torus(long targetFaces, float noise, char *fileName) {
+	const float major = 1.0f, minor = 0.3f;
+	uint32_t rings, sides, numVertices, numFaces, i, j;
+	uint32_t *faces;
+	float *positions;
+
+	/* faces = 2 * rings * sides with twice as many rings as sides */
+	sides = (uint32_t)ceil(sqrt(targetFaces/4.0));
+	if(sides < 3) sides = 3;
+	rings = 2 * sides;
+	numVertices = rings * sides;
+	numFaces = 2 * numVertices;
+	positions = (float*)malloc(3 * (size_t)numVertices * sizeof(float));
+	faces = (uint32_t*)malloc(3 * (size_t)numFaces * sizeof(uint32_t));
+	srand(1);
+	for(i = 0; i < rings; i++) {
+		float u = 2.0f * M_PI * i/rings;
+		for(j = 0; j < sides; j++) {
+			float v = 2.0f * M_PI * j/sides;
+			float r = minor * (1.0f + noise * (2.0f * rand()/(float)RAND_MAX - 1.0f));
+			float *p = positions + 3 * ((size_t)i * sides + j);
+			p[0] = (major + r * cos(v)) * cos(u);
+			p[1] = (major + r * cos(v)) * sin(u);
+			p[2] = r * sin(v);
+		}
+	}
+	for(i = 0; i < rings; i++) {
+		for(j = 0; j < sides; j++) {
+			uint32_t a = i * sides + j;
+			uint32_t b = ((i + 1) % rings) * sides + j;
+			uint32_t c = ((i + 1) % rings) * sides + (j + 1) % sides;
+			uint32_t d = i * sides + (j + 1) % sides;
+			uint32_t *out = faces + 6 * (size_t)a;
+			out[0] = a; out[1] = b; out[2] = c;
+			out[3] = a; out[4] = c; out[5] = d;
+		}
+	}
+	writeOff(fileName, positions, numVertices, faces, numFaces);
+	printf("Wrote %u vertices and %u faces to %s.\n", numVertices, numFaces, fileName);
+	free(positions);
+	free(faces);
+}
+
+int main(int argc, char **argv) {
+	if(argc >= 4 && !strcmp(argv[1], "icosphere")) {
+		int level = atoi(argv[2]);
+		if(level < 0 || level > 11) {
+			printf("Level must be between 0 and 11.\n");
+			return 1;
+		}
+		icosphere(level, argv[3]);
+	}
+	else if(argc >= 4 && !strcmp(argv[1], "torus")) {
+		torus(atol(argv[2]), argc >= 5 ? atof(argv[4]) : 0.0f, argv[3]);
+	}
+	else {
+		usage(argv[0]);
+		return 1;
+	}
+	return 0;
+}
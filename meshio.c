@@ -1,186 +1,612 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <ctype.h>
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "meshio.h"
+#include "stats.h"
+
+#define PAIR_EMPTY UINT64_MAX
+#define PARALLEL_PAIR_FACES 100000 /* Smaller meshes are paired on one thread */
+#define PARALLEL_PARSE_SIZE (1 << 20) /* Files smaller than this are parsed on one thread */
 
-#define MAP_CAPACITY 100000000
-#define PROGRESS_RATE 0.1
+int useMeshCache = 1;
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define ABS(a) ((a) < 0 ? (-(a)) : (a))
 
-HashMap* initMap(int capacity) {
-	int i;
-	HashMap* map = (HashMap*)malloc(sizeof(HashMap));
-	map->modulus = capacity;
-	map->map = (MapNode**)malloc(capacity * sizeof(MapNode*));
-	for(i = 0; i < capacity; i++) map->map[i] = NULL;
-	return map;
+/**
+* Key of the undirected edge between vertices a and b.
+*/
+uint64_t edgeKey(int a, int b) {
+	return a < b ? (uint64_t)a << 32 | (uint32_t)b : (uint64_t)b << 32 | (uint32_t)a;
+}
+
+uint64_t edgeHash(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+void initPairTable(PairTable *table, int expected) {
+	uint64_t i, capacity = 16;
+	while(capacity < 2 * (uint64_t)expected) capacity *= 2;
+	table->mask = capacity - 1;
+	table->count = 0;
+	table->keys = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+	table->values = (int*)malloc(capacity * sizeof(int));
+	for(i = 0; i < capacity; i++) table->keys[i] = PAIR_EMPTY;
+}
+
+void destroyPairTable(PairTable *table) {
+	free(table->keys);
+	free(table->values);
+}
+
+/**
+* Find the slot holding key, or the empty slot it would be inserted at.
+*/
+uint64_t pairSlot(PairTable *table, uint64_t key, uint64_t hash) {
+	uint64_t slot = hash & table->mask;
+	while(table->keys[slot] != key && table->keys[slot] != PAIR_EMPTY) slot = (slot + 1) & table->mask;
+	return slot;
+}
+
+void growPairTable(PairTable *table) {
+	PairTable bigger;
+	uint64_t i;
+	initPairTable(&bigger, table->mask + 1);
+	for(i = 0; i <= table->mask; i++) {
+		if(table->keys[i] != PAIR_EMPTY) {
+			uint64_t slot = pairSlot(&bigger, table->keys[i], edgeHash(table->keys[i]));
+			bigger.keys[slot] = table->keys[i];
+			bigger.values[slot] = table->values[i];
+		}
+	}
+	bigger.count = table->count;
+	destroyPairTable(table);
+	*table = bigger;
+}
+
+typedef struct _pairjob {
+	int shard, shards;
+	int numFaces;
+	int *indices;
+	int *pairs;
+	int foundPairs;
+} PairJob;
+
+/**
+* Pair up the half edges whose key hashes into this job's shard. The half edges
+* are visited in order, so the result does not depend on the number of shards.
+*/
+void *pairShard(void *arg) {
+	PairJob *job = (PairJob*)arg;
+	PairTable table;
+	int i, a, b;
+	initPairTable(&table, (int)(1.5 * job->numFaces / job->shards) + 1);
+	job->foundPairs = 0;
+	for(i = 0; i < 3 * job->numFaces; i++) {
+		uint64_t key, hash, slot;
+		a = job->indices[i];
+		b = job->indices[i % 3 == 2 ? i - 2 : i + 1];
+		key = edgeKey(a, b);
+		hash = edgeHash(key);
+		if((int)((hash >> 40) % job->shards) != job->shard) continue;
+		slot = pairSlot(&table, key, hash);
+		if(table.keys[slot] == key) {
+			job->pairs[i] = table.values[slot];
+			job->pairs[table.values[slot]] = i;
+			job->foundPairs += 2;
+		}
+		else {
+			table.keys[slot] = key;
+			table.values[slot] = i;
+			table.count++;
+			if(4 * (uint64_t)table.count > 3 * (table.mask + 1)) growPairTable(&table);
+		}
+	}
+	destroyPairTable(&table);
+	return NULL;
 }
 
-void destroyChain(MapNode* node) {
-	while(node != NULL) {
-		MapNode *next = node->next;
-		free(node);
-		node = next;
+/**
+* Match the half edges of a triangle list with their twins. Half edge 3i+k runs from
+* vertex indices[3i+k] to the next vertex of triangle i. pairs receives the index of
+* each twin, or -1 for boundary half edges, and the number of paired half edges is
+* returned. The open addressing tables are sized from the face count and split into
+* one shard per thread.
+*/
+int pairHalfEdges(int numFaces, int *indices, int *pairs, int threads) {
+	PairJob *jobs;
+	pthread_t *ids;
+	int i, foundPairs = 0;
+	if(threads < 1 || numFaces < PARALLEL_PAIR_FACES) threads = 1;
+	for(i = 0; i < 3 * numFaces; i++) pairs[i] = -1;
+	jobs = (PairJob*)malloc(threads * sizeof(PairJob));
+	ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	for(i = 0; i < threads; i++) {
+		jobs[i].shard = i;
+		jobs[i].shards = threads;
+		jobs[i].numFaces = numFaces;
+		jobs[i].indices = indices;
+		jobs[i].pairs = pairs;
+	}
+	if(threads == 1) pairShard(&jobs[0]);
+	else {
+		for(i = 0; i < threads; i++) pthread_create(&ids[i], NULL, pairShard, &jobs[i]);
+		for(i = 0; i < threads; i++) pthread_join(ids[i], NULL);
 	}
+	for(i = 0; i < threads; i++) foundPairs += jobs[i].foundPairs;
+	free(jobs);
+	free(ids);
+	return foundPairs;
 }
 
-void destroyMap(HashMap* map) {
+/**
+* Given a filename, read an OFF mesh from that file in the
+* objects folder into a Mesh object.
+*/
+Mesh* readMesh(char* fileName, float dimensions[6]) {
+	Mesh *m;
+	char* newName = malloc((9 + strlen(fileName)) * sizeof(char));
+	newName[0] = 0;
+	strcat(newName, "objects/");
+	strcat(newName, fileName);
+	m = readMeshFile(newName, dimensions);
+	free(newName);
+	return m;
+}
+
+/**
+* Parse a decimal integer token with an optional sign, returning the position
+* after it or NULL if there is no integer at p. Leading whitespace is skipped
+* and magnitudes beyond INT_MAX are clamped to it.
+*/
+const char *parseInt(const char *p, const char *end, int *result) {
+	int neg = 0;
+	long long value = 0;
+	while(p < end && isspace((unsigned char)*p)) p++;
+	if(p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+	if(p == end || !isdigit((unsigned char)*p)) return NULL;
+	while(p < end && isdigit((unsigned char)*p)) {
+		if(value < INT_MAX) value = value * 10 + (*p - '0');
+		p++;
+	}
+	if(value > INT_MAX) value = INT_MAX;
+	*result = neg ? -(int)value : (int)value;
+	return p;
+}
+
+/**
+* Slow path of parseFloat, hands the token to strtof.
+*/
+const char *parseFloatToken(const char *p, const char *end, float *result) {
+	char buffer[128];
+	char *stop;
+	int length = 0;
+	while(p + length < end && length < 127 && !isspace((unsigned char)p[length])) {
+		buffer[length] = p[length];
+		length++;
+	}
+	buffer[length] = 0;
+	*result = strtof(buffer, &stop);
+	if(stop == buffer) return NULL;
+	return p + (stop - buffer);
+}
+
+/**
+* Parse a floating point token, returning the position after it or NULL if there
+* is no number at p. Leading whitespace is skipped. Plain decimal tokens are
+* converted without the C library and give the same correctly rounded float as
+* strtof/fscanf, everything else (long mantissas, huge exponents, inf, nan, hex)
+* and the rare double rounding tie falls back to strtof.
+*/
+const char *parseFloat(const char *p, const char *end, float *result) {
+	static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+		1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+	const char *start, *q;
+	unsigned long long mantissa = 0;
+	int neg = 0, digits = 0, exponent = 0, expNeg = 0, expValue = 0;
+	double value;
+	uint64_t bits;
+
+	while(p < end && isspace((unsigned char)*p)) p++;
+	start = p;
+	q = p;
+	if(q < end && (*q == '-' || *q == '+')) neg = *q++ == '-';
+	while(q < end && isdigit((unsigned char)*q)) {
+		mantissa = mantissa * 10 + (*q++ - '0');
+		digits++;
+	}
+	if(q < end && *q == '.') {
+		q++;
+		while(q < end && isdigit((unsigned char)*q)) {
+			mantissa = mantissa * 10 + (*q++ - '0');
+			digits++;
+			exponent--;
+		}
+	}
+	if(digits == 0 || digits > 15) return parseFloatToken(start, end, result);
+	if(q < end && (*q == 'e' || *q == 'E')) {
+		q++;
+		if(q < end && (*q == '-' || *q == '+')) expNeg = *q++ == '-';
+		if(q == end || !isdigit((unsigned char)*q)) return parseFloatToken(start, end, result);
+		while(q < end && isdigit((unsigned char)*q) && expValue < 1000) expValue = expValue * 10 + (*q++ - '0');
+		exponent += expNeg ? -expValue : expValue;
+	}
+	if(q < end && !isspace((unsigned char)*q)) return parseFloatToken(start, end, result);
+	if(exponent < -22 || exponent > 22) return parseFloatToken(start, end, result);
+
+	/* Both operands are exact doubles, so this single operation is correctly rounded */
+	value = exponent < 0 ? mantissa/powers[-exponent] : mantissa * powers[exponent];
+	if(value != 0.0 && (value < FLT_MIN || value > FLT_MAX)) return parseFloatToken(start, end, result);
+	/* A double exactly halfway between two floats may have been rounded onto the tie */
+	memcpy(&bits, &value, sizeof(bits));
+	if((bits & 0x1FFFFFFF) == 0x10000000) return parseFloatToken(start, end, result);
+
+	*result = (float)(neg ? -value : value);
+	return q;
+}
+
+/**
+* Parse count vertices from p into positions, returning the end of the parsed text or NULL.
+*/
+const char *parseVertices(const char *p, const char *end, int count, float *positions) {
 	int i;
-	for(i = 0; i < map->modulus; i++) destroyChain(map->map[i]);
-	free(map->map);
-	free(map);
+	for(i = 0; i < 3 * count && p != NULL; i++) p = parseFloat(p, end, positions + i);
+	return p;
 }
 
-int edgeEqual(EdgeID id1, EdgeID id2) {
-	int min1 = MIN(id1.v1, id1.v2);
-	int min2 = MIN(id2.v1, id2.v2);
-	int max1 = MAX(id1.v1, id1.v2);
-	int max2 = MAX(id2.v1, id2.v2);
-	return min1 == min2 && max1 == max2;
+/**
+* Parse count triangles from p into indices. Returns the end of the parsed text, or
+* NULL on malformed input. The position of the first non-triangle is stored in badFace.
+*/
+const char *parseFaces(const char *p, const char *end, int count, int *indices, int *badFace) {
+	int i, vCount;
+	*badFace = -1;
+	for(i = 0; i < count; i++) {
+		p = parseInt(p, end, &vCount);
+		if(p == NULL) return NULL;
+		if(vCount != 3) {
+			*badFace = i;
+			return p;
+		}
+		p = parseInt(p, end, indices + 3 * i);
+		if(p != NULL) p = parseInt(p, end, indices + 3 * i + 1);
+		if(p != NULL) p = parseInt(p, end, indices + 3 * i + 2);
+		if(p == NULL) return NULL;
+	}
+	return p;
+}
+
+typedef struct _parsejob {
+	const char *start, *end;
+	int numVertices, numFaces;
+	int firstLine; /* Element number of the first non blank line starting in this range */
+	int numLines;
+	float *positions;
+	int *indices;
+	int badFace; /* First non-triangle found by this job, or -1 */
+	int failed;
+} ParseJob;
+
+int blankLine(const char *p, const char *end) {
+	while(p < end && *p != '\n') {
+		if(!isspace((unsigned char)*p)) return 0;
+		p++;
+	}
+	return 1;
 }
 
-int edgeHash(HashMap *map, EdgeID id) {
-	int min = MIN(id.v1, id.v2);
-	int max = MAX(id.v1, id.v2);
-	return (min * (unsigned long long int)997 + max) % map->modulus;
+const char *lineEnd(const char *p, const char *end) {
+	const char *nl = memchr(p, '\n', end - p);
+	return nl == NULL ? end : nl;
 }
 
 /**
-* Associate the key with a value in the given map.
-* This will not change an existing key and should only
-* be used for insertion (which is assumed to be the case
-* for constructing a manifold mesh).
+* First pass of the threaded parser, count the non blank lines starting in the range.
 */
-void mapPut(HashMap *map, EdgeID key, Edge *value) {
-	int hash = edgeHash(map, key);
-	MapNode *newNode = (MapNode*)malloc(sizeof(MapNode));
-	newNode->next = map->map[hash];
-	newNode->key.v1 = key.v1;
-	newNode->key.v2 = key.v2;
-	newNode->value = value;
-	map->map[hash] = newNode;
+void *countLines(void *arg) {
+	ParseJob *job = (ParseJob*)arg;
+	const char *p = job->start;
+	job->numLines = 0;
+	while(p < job->end) {
+		const char *eol = lineEnd(p, job->end);
+		if(!blankLine(p, eol)) job->numLines++;
+		p = eol + 1;
+	}
+	return NULL;
 }
 
-Edge* mapGet(HashMap* map, EdgeID key) {
-	int hash = edgeHash(map, key);
-	MapNode *node = map->map[hash];
-	while(node != NULL) {
-		if(edgeEqual(node->key, key)) return node->value;
-		node = node->next;
+/**
+* Second pass of the threaded parser, parse every line of the range as one vertex or face.
+*/
+void *parseLines(void *arg) {
+	ParseJob *job = (ParseJob*)arg;
+	const char *p = job->start;
+	int line = job->firstLine;
+	int vCount;
+	job->badFace = -1;
+	job->failed = 0;
+	while(p < job->end && !job->failed) {
+		const char *eol = lineEnd(p, job->end);
+		if(!blankLine(p, eol)) {
+			const char *q = p;
+			if(line < job->numVertices) {
+				q = parseVertices(q, eol, 1, job->positions + 3 * line);
+			}
+			else if(line < job->numVertices + job->numFaces) {
+				int face = line - job->numVertices;
+				q = parseInt(q, eol, &vCount);
+				if(q != NULL && vCount != 3) {
+					job->badFace = face;
+					return NULL;
+				}
+				if(q != NULL) q = parseInt(q, eol, job->indices + 3 * face);
+				if(q != NULL) q = parseInt(q, eol, job->indices + 3 * face + 1);
+				if(q != NULL) q = parseInt(q, eol, job->indices + 3 * face + 2);
+			}
+			/* Lines must hold exactly one element, otherwise the serial parser decides */
+			if(q == NULL || !blankLine(q, eol)) job->failed = 1;
+			line++;
+		}
+		p = eol + 1;
 	}
 	return NULL;
 }
 
 /**
-* Given a filename, read an OFF mesh from that file
+* Parse the vertex and face sections with several threads, splitting the text at line
+* boundaries. This requires one element per line and returns 0 if the text does not
+* look like that, in which case the caller should use the serial parser.
+*/
+int parseThreaded(const char *p, const char *end, int numVertices, int numFaces,
+		float *positions, int *indices, int *badFace, int threads) {
+	ParseJob *jobs = (ParseJob*)malloc(threads * sizeof(ParseJob));
+	pthread_t *ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	int i, lines = 0, ok = 1;
+	size_t chunk = (end - p)/threads;
+
+	for(i = 0; i < threads; i++) {
+		jobs[i].start = i == 0 ? p : jobs[i - 1].end;
+		jobs[i].end = i == threads - 1 ? end : p + (i + 1) * chunk;
+		if(jobs[i].end < jobs[i].start) jobs[i].end = jobs[i].start;
+		if(jobs[i].end < end) jobs[i].end = lineEnd(jobs[i].end, end) + 1;
+		if(jobs[i].end > end) jobs[i].end = end;
+		jobs[i].numVertices = numVertices;
+		jobs[i].numFaces = numFaces;
+		jobs[i].positions = positions;
+		jobs[i].indices = indices;
+	}
+
+	for(i = 0; i < threads; i++) pthread_create(&ids[i], NULL, countLines, &jobs[i]);
+	for(i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+	for(i = 0; i < threads; i++) {
+		jobs[i].firstLine = lines;
+		lines += jobs[i].numLines;
+	}
+
+	if(lines == numVertices + numFaces) {
+		for(i = 0; i < threads; i++) pthread_create(&ids[i], NULL, parseLines, &jobs[i]);
+		for(i = 0; i < threads; i++) pthread_join(ids[i], NULL);
+		/* Jobs are in file order and stop at their first problem, so the first one found decides */
+		*badFace = -1;
+		for(i = 0; i < threads; i++) {
+			if(jobs[i].failed) ok = 0;
+			else if(jobs[i].badFace >= 0) *badFace = jobs[i].badFace;
+			else continue;
+			break;
+		}
+	}
+	else ok = 0;
+
+	free(jobs);
+	free(ids);
+	return ok;
+}
+
+/**
+* Map a whole file into memory, falling back to reading it when mapping fails.
+*/
+char *mapFile(char *fileName, size_t *size, int *mapped) {
+	char *data;
+	FILE *f;
+	struct stat info;
+	int fd = open(fileName, O_RDONLY);
+	if(fd < 0) return NULL;
+	if(fstat(fd, &info) < 0) {
+		close(fd);
+		return NULL;
+	}
+	*size = info.st_size;
+	*mapped = 1;
+	data = *size == 0 ? MAP_FAILED : (char*)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data != MAP_FAILED) {
+		madvise(data, *size, MADV_SEQUENTIAL);
+		return data;
+	}
+	*mapped = 0;
+	f = fopen(fileName, "rb");
+	if(f == NULL) return NULL;
+	data = (char*)malloc(*size + 1);
+	*size = fread(data, 1, *size, f);
+	fclose(f);
+	return data;
+}
+
+void unmapFile(char *data, size_t size, int mapped) {
+	if(mapped) munmap(data, size);
+	else free(data);
+}
+
+double loadSeconds() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec/1e9;
+}
+
+/**
+* Given a path, read an OFF mesh from that file
 * into a Mesh object. The Mesh object is a winged edge
 * data structure and should be completely filled.
 */
-Mesh* readMesh(char* fileName, float dimensions[6]) {
-	FILE *f;
-	char header[3];
+Mesh* readMeshFile(char* fileName, float dimensions[6]) {
+	char *cacheName;
+	CompactMesh *c;
+	struct stat source;
+	char *data;
+	const char *p, *end;
+	size_t size;
+	int mapped, cached;
 	int numVertices, numFaces, numEdges;
-	Vertex **verts;
-	Face **faces;
-	Edge **edges;
-	HashMap* edgeMap;
-	int *visited;
-	int vCount, v1, v2, v3;
-	EdgeID ei1, ei2, ei3;
-	Edge *edge1, *edge2, *edge3;
-	Edge *e1p, *e2p, *e3p;
+	float *positions;
+	int *indices;
+	int badFace = -1;
+	double start, elapsed;
 	Mesh *m;
-	int i, foundPairs;
-	double progress = -1.0f, curProgress = 0.0f;
-	
-	dimensions[0] = 1e20;
-	dimensions[1] = -1e20;
-	dimensions[2] = 1e20;
-	dimensions[3] = -1e20;
-	dimensions[4] = 1e20;
-	dimensions[5] = -1e20;
+	STATS_START(timer);
 	
-	char* newName = malloc((9 + strlen(fileName)) * sizeof(char));
-	newName[0] = 0;
-	strcat(newName, "objects/");
-	strcat(newName, fileName);
-	f = fopen(newName, "r");
+	start = loadSeconds();
+	cacheName = (char*)malloc(strlen(fileName) + strlen(CACHE_EXTENSION) + 1);
+	strcpy(cacheName, fileName);
+	strcat(cacheName, CACHE_EXTENSION);
+	cached = useMeshCache && stat(fileName, &source) == 0;
+	if(cached && (c = mapMeshCache(cacheName, &source)) != NULL) {
+		m = unpackMesh(c);
+		destroyCompactMesh(c);
+		STATS_PHASE(PHASE_LOAD, timer);
+		meshDimensions(m, dimensions);
+		printf("Loaded %d verticies and %d faces from cache %s in %.3f s.\n",
+			m->numVertices, m->numFaces, cacheName, loadSeconds() - start);
+		free(cacheName);
+		return m;
+	}
 	
-	if(f == NULL) {
+	data = mapFile(fileName, &size, &mapped);
+	if(data == NULL) {
 		printf("Could not open file %s for reading, does it exist?\n", fileName);
 		exit(1);
 	}
-	fscanf(f, "%s", header);
-	if(strncmp(header, "OFF", 3)) {
+	p = data;
+	end = data + size;
+	while(p < end && isspace((unsigned char)*p)) p++;
+	if(end - p < 3 || strncmp(p, "OFF", 3)) {
 		printf("Model file %s is not in object file format (OFF).\n", fileName);
 		exit(2);
 	}
+	while(p < end && !isspace((unsigned char)*p)) p++;
 	
-	fscanf(f, "%d %d %d", &numVertices, &numFaces, &numEdges);
-	
-	verts = (Vertex**)malloc(numVertices * sizeof(Vertex*));
-	faces = (Face**)malloc(numFaces * sizeof(Face*));
-	edges = (Edge**)malloc(3 * numFaces * sizeof(Edge*));
+	p = parseInt(p, end, &numVertices);
+	if(p != NULL) p = parseInt(p, end, &numFaces);
+	if(p != NULL) p = parseInt(p, end, &numEdges);
+	if(p == NULL || numVertices < 0 || numFaces < 0) {
+		printf("Model file %s is malformed.\n", fileName);
+		exit(7);
+	}
+	p = lineEnd(p, end);
 	
-	printf("Loading %d verticies...\n", numVertices);
-	for(i = 0; i < numVertices; i++) {
-		curProgress = i/(float)numVertices;
-		if(curProgress - progress >= PROGRESS_RATE) {
-			progress = curProgress;
-			printf("%d%% complete.\n", (int)(progress * 100));
+	printf("Loading %d verticies and %d faces...\n", numVertices, numFaces);
+	positions = (float*)malloc(3 * numVertices * sizeof(float));
+	indices = (int*)malloc(3 * numFaces * sizeof(int));
+	if(meshThreads <= 1 || size < PARALLEL_PARSE_SIZE ||
+			!parseThreaded(p, end, numVertices, numFaces, positions, indices, &badFace, meshThreads)) {
+		p = parseVertices(p, end, numVertices, positions);
+		if(p != NULL) p = parseFaces(p, end, numFaces, indices, &badFace);
+		if(p == NULL) {
+			printf("Model file %s is malformed.\n", fileName);
+			exit(7);
 		}
-		verts[i] = (Vertex*)malloc(sizeof(Vertex));
-		verts[i]->index = i;
-		fscanf(f, "%f %f %f", &(verts[i]->x), &(verts[i]->y), &(verts[i]->z));
-		dimensions[0] = MIN(dimensions[0], verts[i]->x);
-		dimensions[1] = MAX(dimensions[1], verts[i]->x);
-		dimensions[2] = MIN(dimensions[2], verts[i]->y);
-		dimensions[3] = MAX(dimensions[3], verts[i]->y);
-		dimensions[4] = MIN(dimensions[4], verts[i]->z);
-		dimensions[5] = MAX(dimensions[5], verts[i]->z);
-	}
-	printf("100%% complete.\n");
+	}
+	elapsed = loadSeconds() - start;
+	printf("Parsed %.1f MB in %.3f s (%.1f MB/s).\n", size/1e6, elapsed, elapsed > 0.0 ? size/1e6/elapsed : 0.0);
+	unmapFile(data, size, mapped);
+	STATS_PHASE(PHASE_LOAD, timer);
 	
-	progress = -1.0f;
-	visited = (int*)malloc(numVertices * sizeof(int));
-	for(i = 0; i < numVertices; i++) visited[i] = 0;
-	edgeMap = initMap(MAP_CAPACITY);
-	foundPairs = 0;
-	printf("Loading %d faces...\n", numFaces);
-	for(i = 0; i < numFaces; i++) {
-		curProgress = i/(float)numFaces;
-		if(curProgress - progress >= PROGRESS_RATE) {
-			progress = curProgress;
-			printf("%d%% complete.\n", (int)(progress * 100));
-		}
-		fscanf(f, "%d", &vCount);
-		if(vCount != 3) {
-			printf("Non-triangle meshes are not supported.");
-			exit(3);
-		}
-		fscanf(f, "%d %d %d", &v1, &v2, &v3);
+	m = linkMesh(fileName, numVertices, positions, numFaces, indices, badFace, dimensions);
+	free(positions);
+	free(indices);
+	
+	if(cached) {
+		c = packMesh(m);
+		if(!writeMeshCache(c, cacheName, &source)) printf("Could not write mesh cache %s.\n", cacheName);
+		destroyCompactMesh(c);
+	}
+	free(cacheName);
+	return m;
+}
+
+/**
+* Build a mesh from a vertex position array and a triangle index array,
+* pairing up the half edges. badFace is the position of the first
+* non-triangle in the source file, or -1 if there is none.
+*/
+Mesh *linkMesh(char *fileName, int numVertices, float *positions, int numFaces, int *indices,
+		int badFace, float dimensions[6]) {
+	Vertex **verts;
+	Face **faces;
+	Edge **edges;
+	int v1, v2, v3;
+	Edge *edge1, *edge2, *edge3;
+	Mesh *m;
+	int i, foundPairs, *pairs;
+	STATS_START(timer);
+	
+	for(i = 0; i < numFaces && i != badFace; i++) {
+		v1 = indices[3 * i];
+		v2 = indices[3 * i + 1];
+		v3 = indices[3 * i + 2];
 		if(v1 < 0 || v2 < 0 || v3 < 0) {
 			printf("Invalid vertex specified in mesh file %s. Indexing starts at 0.\n", fileName);
 			exit(4);
 		}
-		else if(v1 >= numVertices || v2 > numVertices || v3 > numVertices) {
+		else if(v1 >= numVertices || v2 >= numVertices || v3 >= numVertices) {
 			printf("Invalid vertex specified in mesh file %s. Indexing ends at %d.\n", fileName, numVertices - 1);
 			exit(5);
 		}
+	}
+	if(badFace >= 0) {
+		printf("Non-triangle meshes are not supported.");
+		exit(3);
+	}
+	
+	m = initMesh(numVertices, numFaces, 3 * numFaces);
+	verts = m->verts;
+	faces = m->faces;
+	edges = m->edges;
+	
+	for(i = 0; i < numVertices; i++) {
+		verts[i] = newVertex(m);
+		verts[i]->index = i;
+		verts[i]->x = positions[3 * i];
+		verts[i]->y = positions[3 * i + 1];
+		verts[i]->z = positions[3 * i + 2];
+		verts[i]->edge = NULL;
+	}
+	meshDimensions(m, dimensions);
+	
+	for(i = 0; i < numFaces; i++) {
+		v1 = indices[3 * i];
+		v2 = indices[3 * i + 1];
+		v3 = indices[3 * i + 2];
 		
-		ei1.v1 = v1;
-		ei1.v2 = v2;
-		ei2.v1 = v2;
-		ei2.v2 = v3;
-		ei3.v1 = v3;
-		ei3.v2 = v1;
-		
-		faces[i] = (Face*)malloc(sizeof(Face));
+		faces[i] = newFace(m);
 		faces[i]->index = i;
 		
-		edge1 = (Edge*)malloc(sizeof(Edge));
-		edge2 = (Edge*)malloc(sizeof(Edge));
-		edge3 = (Edge*)malloc(sizeof(Edge));
+		edge1 = newEdge(m);
+		edge2 = newEdge(m);
+		edge3 = newEdge(m);
 		edges[3 * i] = edge1;
 		edges[3 * i + 1] = edge2;
 		edges[3 * i + 2] = edge3;
@@ -190,77 +616,64 @@ Mesh* readMesh(char* fileName, float dimensions[6]) {
 		edge1->face = faces[i];
 		edge1->next = edge2;
 		edge1->prev = edge3;
-		edge1->pair = NULL;
 		
 		edge2->index = 3 * i + 1;
 		edge2->vert = verts[v3];
 		edge2->face = faces[i];
 		edge2->next = edge3;
 		edge2->prev = edge1;
-		edge2->pair = NULL;
 		
 		edge3->index = 3 * i + 2;
 		edge3->vert = verts[v1];
 		edge3->face = faces[i];
 		edge3->next = edge1;
 		edge3->prev = edge2;
-		edge3->pair = NULL;
 		
 		faces[i]->edge = edge1;
 		
-		if(!visited[v1]) {
-			visited[v1] = 1;
-			verts[v1]->edge = edge3;
-		}
-		if(!visited[v2]) {
-			visited[v2] = 1;
-			verts[v2]->edge = edge1;
-		}
-		if(!visited[v3]) {
-			visited[v3] = 1;
-			verts[v3]->edge = edge2;
-		}
-		
-		e1p = mapGet(edgeMap, ei1);
-		if(e1p == NULL) mapPut(edgeMap, ei1, edge1);
-		else {
-			edge1->pair = e1p;
-			e1p->pair = edge1;
-			foundPairs += 2;
-		}
-		
-		e2p = mapGet(edgeMap, ei2);
-		if(e2p == NULL) mapPut(edgeMap, ei2, edge2);
-		else {
-			edge2->pair = e2p;
-			e2p->pair = edge2;
-			foundPairs += 2;
-		}
-		
-		e3p = mapGet(edgeMap, ei3);
-		if(e3p == NULL) mapPut(edgeMap, ei3, edge3);
-		else {
-			edge3->pair = e3p;
-			e3p->pair = edge3;
-			foundPairs += 2;
-		}
+		if(verts[v1]->edge == NULL) verts[v1]->edge = edge3;
+		if(verts[v2]->edge == NULL) verts[v2]->edge = edge1;
+		if(verts[v3]->edge == NULL) verts[v3]->edge = edge2;
 	}
-	printf("100%% complete.\n");
+	
+	pairs = (int*)malloc(3 * numFaces * sizeof(int));
+	foundPairs = pairHalfEdges(numFaces, indices, pairs, meshThreads);
 	if(foundPairs != numFaces * 3) {
 		printf("Mesh in file %s is non-manifold. Found %d edge pairs but have %d faces.\n", fileName, foundPairs, numFaces * 3);
 		exit(6);
 	}
+	for(i = 0; i < 3 * numFaces; i++) edges[i]->pair = pairs[i] < 0 ? NULL : edges[pairs[i]];
+	free(pairs);
+	STATS_PHASE(PHASE_LINK, timer);
 	
-	destroyMap(edgeMap);
-	fclose(f);
-	free(visited);
-	
-	m = initMesh(numVertices, numFaces, 3 * numFaces, verts, faces, edges);
+	buildMesh(m);
 	return m;
 }
 
+/**
+* Compute the bounding box of the mesh as min x, max x, min y, max y, min z, max z.
+*/
+void meshDimensions(Mesh *m, float dimensions[6]) {
+	int i;
+	dimensions[0] = 1e20;
+	dimensions[1] = -1e20;
+	dimensions[2] = 1e20;
+	dimensions[3] = -1e20;
+	dimensions[4] = 1e20;
+	dimensions[5] = -1e20;
+	for(i = 0; i < m->numVertices; i++) {
+		dimensions[0] = MIN(dimensions[0], m->verts[i]->x);
+		dimensions[1] = MAX(dimensions[1], m->verts[i]->x);
+		dimensions[2] = MIN(dimensions[2], m->verts[i]->y);
+		dimensions[3] = MAX(dimensions[3], m->verts[i]->y);
+		dimensions[4] = MIN(dimensions[4], m->verts[i]->z);
+		dimensions[5] = MAX(dimensions[5], m->verts[i]->z);
+	}
+}
+
 void printMesh(Mesh *m, FILE *f) {
 	int i;
+	STATS_START(timer);
 	fprintf(f, "OFF\n");
 	fprintf(f, "%d %d 0\n", m->numVertices, m->numFaces);
 	for(i = 0; i < m->numVertices; i++) {
@@ -269,6 +682,7 @@ void printMesh(Mesh *m, FILE *f) {
 	for(i = 0; i < m->numFaces; i++) {
 		fprintf(f, "3 %d %d %d\n", m->faces[i]->edge->vert->index, m->faces[i]->edge->next->vert->index, m->faces[i]->edge->next->next->vert->index);
 	}
+	STATS_PHASE(PHASE_WRITE, timer);
 	
 	/** Test Stuff **/
 	/*
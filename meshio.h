@@ -3,25 +3,33 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include "mesh.h"
+#include "meshcache.h"
 
-typedef struct _edgeid {
-	int v1, v2;
-} EdgeID;
+typedef struct _pairtable {
+	uint64_t mask;
+	int count;
+	uint64_t *keys; /* Packed (min, max) vertex pairs */
+	int *values; /* First half edge seen with each key */
+} PairTable;
 
-typedef struct _mapnode {
-	struct _edgeid key;
-	Edge *value;
-	
-	struct _mapnode *next;
-} MapNode;
+extern int useMeshCache; /* Load from and write binary caches next to OFF files */
 
-typedef struct _hashmap {
-	int modulus;
-	struct _mapnode **map;
-} HashMap;
+int pairHalfEdges(int numFaces, int *indices, int *pairs, int threads);
+
+char *mapFile(char *fileName, size_t *size, int *mapped);
+void unmapFile(char *data, size_t size, int mapped);
+const char *lineEnd(const char *p, const char *end);
+const char *parseInt(const char *p, const char *end, int *result);
+const char *parseVertices(const char *p, const char *end, int count, float *positions);
+const char *parseFaces(const char *p, const char *end, int count, int *indices, int *badFace);
 
 Mesh *readMesh(char *fileName, float dimensions[6]);
+Mesh *readMeshFile(char *fileName, float dimensions[6]);
+Mesh *linkMesh(char *fileName, int numVertices, float *positions, int numFaces, int *indices,
+	int badFace, float dimensions[6]);
+void meshDimensions(Mesh *m, float dimensions[6]);
 void printMesh(Mesh *m, FILE *f);
 
 #endif
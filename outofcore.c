@@ -0,0 +1,616 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "outofcore.h"
+#include "meshio.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define OOC_BLOCK 65536 /* Vertices or faces parsed or copied at a time */
+#define OOC_BUFFER_FACES 1024 /* Faces buffered per chunk while sorting them */
+#define OOC_MIN_CHUNK 4096 /* Fewest faces a chunk may be sized for */
+
+#define OWNER_NONE -1
+#define OWNER_SHARED -2
+#define SEAM_ID(k) (-3 - (k)) /* Owner of the k-th seam vertex once they are numbered */
+#define SEAM_INDEX(owner) (-3 - (owner))
+#define IS_SEAM(owner) ((owner) <= SEAM_ID(0))
+#define GHOST -2 /* Output id of the vertices closing chunk boundaries */
+
+#define CELL(x, y, z) (((x) * OOC_GRID + (y)) * OOC_GRID + (z))
+#define NEXT(h) ((h) % 3 == 2 ? (h) - 2 : (h) + 1)
+
+/**
+* Create a scratch file next to near. It is unlinked right away, so it
+* disappears when closed or when the program exits.
+*/
+FILE *scratchFile(char *near) {
+	char *name = (char*)malloc(strlen(near) + 8);
+	FILE *f = NULL;
+	int fd;
+	if(name == NULL) {
+		printf("Out of memory creating a scratch file next to %s.\n", near);
+		exit(2);
+	}
+	sprintf(name, "%s.XXXXXX", near);
+	fd = mkstemp(name);
+	if(fd >= 0) {
+		unlink(name);
+		f = fdopen(fd, "w+b");
+	}
+	if(f == NULL) {
+		printf("Could not create a scratch file next to %s.\n", near);
+		exit(2);
+	}
+	free(name);
+	return f;
+}
+
+/**
+* Map the first size bytes of a scratch file for reading and writing, growing it if needed.
+*/
+void *mapScratch(FILE *f, size_t size) {
+	void *data = MAP_FAILED;
+	if(size == 0) size = 1;
+	fflush(f);
+	if(ftruncate(fileno(f), size) == 0) data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(f), 0);
+	if(data == MAP_FAILED) {
+		printf("Could not map %lu bytes of scratch space.\n", (unsigned long)size);
+		exit(2);
+	}
+	return data;
+}
+
+void readScratch(FILE *f, void *data, size_t size, long long offset) {
+	char *p = (char*)data;
+	while(size > 0) {
+		ssize_t done = pread(fileno(f), p, size, offset);
+		if(done <= 0) {
+			printf("Could not read back scratch data.\n");
+			exit(2);
+		}
+		p += done;
+		size -= done;
+		offset += done;
+	}
+}
+
+void writeScratch(FILE *f, const void *data, size_t size, long long offset) {
+	const char *p = (const char*)data;
+	while(size > 0) {
+		ssize_t done = pwrite(fileno(f), p, size, offset);
+		if(done <= 0) {
+			printf("Could not write scratch data.\n");
+			exit(2);
+		}
+		p += done;
+		size -= done;
+		offset += done;
+	}
+}
+
+/**
+* Histogram cell holding the centroid of a face.
+*/
+int cellOf(OutOfCore *o, const int *face) {
+	int axis, i, cell[3];
+	for(axis = 0; axis < 3; axis++) {
+		float lo = o->bounds[2 * axis], extent = o->bounds[2 * axis + 1] - lo;
+		float c = (o->positions[3 * face[0] + axis] + o->positions[3 * face[1] + axis] +
+			o->positions[3 * face[2] + axis])/3.0f;
+		i = extent > 0.0f ? (int)((c - lo)/extent * OOC_GRID) : 0;
+		cell[axis] = i < 0 ? 0 : (i >= OOC_GRID ? OOC_GRID - 1 : i);
+	}
+	return CELL(cell[0], cell[1], cell[2]);
+}
+
+/**
+* First pass over the input. The positions are copied to a mapped scratch file,
+* and the faces are checked, copied to another and counted into the histogram.
+*/
+void streamInput(OutOfCore *o) {
+	char *data;
+	const char *p, *end;
+	size_t size;
+	float *vertBlock;
+	int *faceBlock;
+	int mapped, numEdges, badFace, count, i, j, k;
+
+	data = mapFile(o->input, &size, &mapped);
+	if(data == NULL) {
+		printf("Could not open file %s for reading, does it exist?\n", o->input);
+		exit(1);
+	}
+	p = data;
+	end = data + size;
+	while(p < end && isspace((unsigned char)*p)) p++;
+	if(end - p < 3 || strncmp(p, "OFF", 3)) {
+		printf("Model file %s is not in object file format (OFF).\n", o->input);
+		exit(2);
+	}
+	while(p < end && !isspace((unsigned char)*p)) p++;
+	p = parseInt(p, end, &o->numVertices);
+	if(p != NULL) p = parseInt(p, end, &o->numFaces);
+	if(p != NULL) p = parseInt(p, end, &numEdges);
+	if(p == NULL || o->numVertices < 0 || o->numFaces < 0) {
+		printf("Model file %s is malformed.\n", o->input);
+		exit(7);
+	}
+	p = lineEnd(p, end);
+	printf("Streaming %d verticies and %d faces...\n", o->numVertices, o->numFaces);
+
+	for(k = 0; k < 3; k++) {
+		o->bounds[2 * k] = 1e20;
+		o->bounds[2 * k + 1] = -1e20;
+	}
+	vertBlock = (float*)malloc(3 * OOC_BLOCK * sizeof(float));
+	for(i = 0; i < o->numVertices; i += count) {
+		count = MIN(OOC_BLOCK, o->numVertices - i);
+		p = parseVertices(p, end, count, vertBlock);
+		if(p == NULL) {
+			printf("Model file %s is malformed.\n", o->input);
+			exit(7);
+		}
+		for(j = 0; j < count; j++) {
+			for(k = 0; k < 3; k++) {
+				o->bounds[2 * k] = MIN(o->bounds[2 * k], vertBlock[3 * j + k]);
+				o->bounds[2 * k + 1] = MAX(o->bounds[2 * k + 1], vertBlock[3 * j + k]);
+			}
+		}
+		fwrite(vertBlock, sizeof(float), 3 * count, o->positionFile);
+	}
+	free(vertBlock);
+	o->positions = (float*)mapScratch(o->positionFile, 3 * (size_t)o->numVertices * sizeof(float));
+
+	faceBlock = (int*)malloc(3 * OOC_BLOCK * sizeof(int));
+	o->cellFaces = (int*)calloc(OOC_GRID * OOC_GRID * OOC_GRID, sizeof(int));
+	for(i = 0; i < o->numFaces; i += count) {
+		count = MIN(OOC_BLOCK, o->numFaces - i);
+		p = parseFaces(p, end, count, faceBlock, &badFace);
+		if(p == NULL) {
+			printf("Model file %s is malformed.\n", o->input);
+			exit(7);
+		}
+		if(badFace >= 0) {
+			printf("Non-triangle meshes are not supported.\n");
+			exit(3);
+		}
+		for(j = 0; j < 3 * count; j++) {
+			if(faceBlock[j] < 0) {
+				printf("Invalid vertex specified in mesh file %s. Indexing starts at 0.\n", o->input);
+				exit(4);
+			}
+			else if(faceBlock[j] >= o->numVertices) {
+				printf("Invalid vertex specified in mesh file %s. Indexing ends at %d.\n", o->input, o->numVertices - 1);
+				exit(5);
+			}
+		}
+		for(j = 0; j < count; j++) o->cellFaces[cellOf(o, faceBlock + 3 * j)]++;
+		fwrite(faceBlock, sizeof(int), 3 * count, o->faceFile);
+	}
+	free(faceBlock);
+	unmapFile(data, size, mapped);
+}
+
+long long boxFaces(OutOfCore *o, const int lo[3], const int hi[3]) {
+	long long count = 0;
+	int x, y, z;
+	for(x = lo[0]; x < hi[0]; x++) {
+		for(y = lo[1]; y < hi[1]; y++) {
+			for(z = lo[2]; z < hi[2]; z++) count += o->cellFaces[CELL(x, y, z)];
+		}
+	}
+	return count;
+}
+
+/**
+* Cut the box of histogram cells [lo, hi) into chunks of at most capacity faces,
+* halving it along its longest side at the median face until the parts fit.
+*/
+void splitCells(OutOfCore *o, const int lo[3], const int hi[3], int capacity) {
+	long long count = boxFaces(o, lo, hi), seen = 0;
+	int axis = 0, cut, i, x, y, z;
+	int slabLo[3], slabHi[3];
+	if(count == 0) return;
+	if(count <= capacity || (hi[0] - lo[0] == 1 && hi[1] - lo[1] == 1 && hi[2] - lo[2] == 1)) {
+		if(count > capacity) printf("A chunk of %lld faces does not fit the memory budget.\n", count);
+		for(x = lo[0]; x < hi[0]; x++) {
+			for(y = lo[1]; y < hi[1]; y++) {
+				for(z = lo[2]; z < hi[2]; z++) o->cellChunk[CELL(x, y, z)] = o->numChunks;
+			}
+		}
+		o->numChunks++;
+		return;
+	}
+	for(i = 1; i < 3; i++) {
+		if(hi[i] - lo[i] > hi[axis] - lo[axis]) axis = i;
+	}
+	/* Keep at least one slab of cells on either side of the cut */
+	memcpy(slabLo, lo, sizeof(slabLo));
+	memcpy(slabHi, hi, sizeof(slabHi));
+	for(cut = lo[axis]; cut < hi[axis] - 2; cut++) {
+		slabLo[axis] = cut;
+		slabHi[axis] = cut + 1;
+		seen += boxFaces(o, slabLo, slabHi);
+		if(2 * seen >= count) break;
+	}
+	memcpy(slabHi, hi, sizeof(slabHi));
+	slabHi[axis] = cut + 1;
+	splitCells(o, lo, slabHi, capacity);
+	memcpy(slabLo, lo, sizeof(slabLo));
+	slabLo[axis] = cut + 1;
+	splitCells(o, slabLo, hi, capacity);
+}
+
+void flushChunk(OutOfCore *o, int *buffers, int *filled, long long *written, int chunk) {
+	writeScratch(o->sortedFile, buffers + 3 * (size_t)chunk * OOC_BUFFER_FACES, 3 * filled[chunk] * sizeof(int),
+		3 * (o->chunkStart[chunk] + written[chunk]) * (long long)sizeof(int));
+	written[chunk] += filled[chunk];
+	filled[chunk] = 0;
+}
+
+/**
+* Second pass, over the copied faces. They are grouped by chunk into the sorted
+* face file, and every vertex is marked with the chunk using it. Vertices used
+* by several chunks are seams and are numbered in order.
+*/
+void sortFaces(OutOfCore *o) {
+	int *buffers, *filled, *block, *face;
+	long long *written;
+	int count, chunk, i, j, k, v;
+
+	o->chunkFaces = (int*)calloc(o->numChunks + 1, sizeof(int));
+	o->chunkStart = (long long*)malloc((o->numChunks + 1) * sizeof(long long));
+	for(i = 0; i < OOC_GRID * OOC_GRID * OOC_GRID; i++) {
+		if(o->cellFaces[i] > 0) o->chunkFaces[o->cellChunk[i]] += o->cellFaces[i];
+	}
+	o->chunkStart[0] = 0;
+	for(i = 0; i < o->numChunks; i++) o->chunkStart[i + 1] = o->chunkStart[i] + o->chunkFaces[i];
+
+	o->owner = (int*)mapScratch(o->ownerFile, (size_t)o->numVertices * sizeof(int));
+	memset(o->owner, 0xFF, (size_t)o->numVertices * sizeof(int)); /* OWNER_NONE */
+	buffers = (int*)malloc(3 * (size_t)o->numChunks * OOC_BUFFER_FACES * sizeof(int));
+	filled = (int*)calloc(o->numChunks, sizeof(int));
+	written = (long long*)calloc(o->numChunks, sizeof(long long));
+	block = (int*)malloc(3 * OOC_BLOCK * sizeof(int));
+	rewind(o->faceFile);
+	for(i = 0; i < o->numFaces; i += count) {
+		count = MIN(OOC_BLOCK, o->numFaces - i);
+		if(fread(block, sizeof(int), 3 * count, o->faceFile) != 3 * (size_t)count) {
+			printf("Could not read back scratch data.\n");
+			exit(2);
+		}
+		for(j = 0; j < count; j++) {
+			face = block + 3 * j;
+			chunk = o->cellChunk[cellOf(o, face)];
+			for(k = 0; k < 3; k++) {
+				v = face[k];
+				if(o->owner[v] == OWNER_NONE) o->owner[v] = chunk;
+				else if(o->owner[v] != chunk) o->owner[v] = OWNER_SHARED;
+			}
+			memcpy(buffers + 3 * ((size_t)chunk * OOC_BUFFER_FACES + filled[chunk]), face, 3 * sizeof(int));
+			if(++filled[chunk] == OOC_BUFFER_FACES) flushChunk(o, buffers, filled, written, chunk);
+		}
+	}
+	for(chunk = 0; chunk < o->numChunks; chunk++) flushChunk(o, buffers, filled, written, chunk);
+	free(buffers);
+	free(filled);
+	free(written);
+	free(block);
+
+	for(v = 0; v < o->numVertices; v++) {
+		if(o->owner[v] == OWNER_SHARED) o->owner[v] = SEAM_ID(o->numSeams++);
+	}
+}
+
+int compareInts(const void *a, const void *b) {
+	int x = *(const int*)a, y = *(const int*)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+* Next boundary half edge of a triangle list after boundary half edge h, found by
+* turning around the vertex h points to through the faces of the list.
+*/
+int nextBoundary(const int *pairs, int h) {
+	int next = NEXT(h);
+	while(pairs[next] >= 0) next = NEXT(pairs[next]);
+	return next;
+}
+
+/**
+* Close a boundary loop, given as its half edges in order, with a fan of faces
+* around the vertex ghost placed at the centroid of the loop. The faces are
+* appended to indices from face slot first on.
+*/
+void addCap(int *indices, int first, const int *loop, int length, int ghost, float *positions) {
+	int i, k;
+	for(k = 0; k < 3; k++) positions[3 * ghost + k] = 0.0f;
+	for(i = 0; i < length; i++) {
+		int from = indices[loop[i]], to = indices[NEXT(loop[i])];
+		for(k = 0; k < 3; k++) positions[3 * ghost + k] += positions[3 * from + k]/length;
+		indices[3 * (first + i)] = to;
+		indices[3 * (first + i) + 1] = from;
+		indices[3 * (first + i) + 2] = ghost;
+	}
+}
+
+/**
+* Close every boundary of a triangle list so it can be linked as a closed mesh.
+* Each boundary loop gets its own ghost vertex, numbered from numLocal on, and a
+* loop passing a vertex twice is split there so no ghost is joined to a vertex
+* twice. Boundary and ghost vertices are flagged in locked. Returns the number
+* of faces added, the number of ghosts is stored in numGhosts.
+*/
+int capBoundaries(int numFaces, int *indices, const int *pairs, int numLocal, float *positions,
+		char *locked, int *numGhosts) {
+	char *visited = (char*)calloc(3 * (size_t)numFaces + 1, 1);
+	int *loop = (int*)malloc((3 * (size_t)numFaces + 1) * sizeof(int));
+	int *onLoop = (int*)malloc((numLocal + 1) * sizeof(int));
+	int numCaps = 0, size, h, c, u, i, j, ghost;
+	for(i = 0; i < numLocal; i++) onLoop[i] = -1;
+	*numGhosts = 0;
+	for(h = 0; h < 3 * numFaces; h++) {
+		if(pairs[h] >= 0 || visited[h]) continue;
+		size = 0;
+		c = h;
+		do {
+			visited[c] = 1;
+			u = indices[c];
+			locked[u] = 1;
+			if(onLoop[u] >= 0) {
+				/* Back at u, the half edges since it was left form a loop of their own */
+				j = onLoop[u];
+				ghost = numLocal + (*numGhosts)++;
+				addCap(indices, numFaces + numCaps, loop + j, size - j, ghost, positions);
+				locked[ghost] = 1;
+				numCaps += size - j;
+				for(i = j; i < size; i++) onLoop[indices[loop[i]]] = -1;
+				size = j;
+			}
+			onLoop[u] = size;
+			loop[size++] = c;
+			c = nextBoundary(pairs, c);
+		} while(c != h);
+		ghost = numLocal + (*numGhosts)++;
+		addCap(indices, numFaces + numCaps, loop, size, ghost, positions);
+		locked[ghost] = 1;
+		numCaps += size;
+		for(i = 0; i < size; i++) onLoop[indices[loop[i]]] = -1;
+	}
+	free(visited);
+	free(loop);
+	free(onLoop);
+	return numCaps;
+}
+
+/**
+* Load one chunk as a closed mesh, with its boundaries capped and its seam vertices
+* locked, reduce it to ratio of its faces and append what is left to the interior
+* position and stitched face files, numbered as the stitched mesh will be.
+*/
+void simplifyChunk(OutOfCore *o, int chunk, float ratio, float (*cost)(Edge*), int rounds) {
+	int numFaces = o->chunkFaces[chunk];
+	int *indices, *verts, *pairs, *finalId, *lockedId;
+	int numLocal, numBoundary = 0, numGhosts, numCaps, numLocked = 0, numWritten = 0, i, k, id[3];
+	Vertex **lockedVerts;
+	float *positions, dimensions[6];
+	char *locked;
+	Mesh *m;
+
+	indices = (int*)malloc((3 * (size_t)numFaces + 1) * sizeof(int));
+	readScratch(o->sortedFile, indices, 3 * (size_t)numFaces * sizeof(int), 3 * o->chunkStart[chunk] * (long long)sizeof(int));
+
+	/* Local numbering of the vertices used by the chunk */
+	verts = (int*)malloc((3 * (size_t)numFaces + 1) * sizeof(int));
+	memcpy(verts, indices, 3 * (size_t)numFaces * sizeof(int));
+	qsort(verts, 3 * (size_t)numFaces, sizeof(int), compareInts);
+	for(i = 0, numLocal = 0; i < 3 * numFaces; i++) {
+		if(numLocal == 0 || verts[i] != verts[numLocal - 1]) verts[numLocal++] = verts[i];
+	}
+	for(i = 0; i < 3 * numFaces; i++) {
+		indices[i] = (int*)bsearch(indices + i, verts, numLocal, sizeof(int), compareInts) - verts;
+	}
+
+	pairs = (int*)malloc((3 * (size_t)numFaces + 1) * sizeof(int));
+	pairHalfEdges(numFaces, indices, pairs, meshThreads);
+	for(i = 0; i < 3 * numFaces; i++) numBoundary += pairs[i] < 0;
+	indices = (int*)realloc(indices, (3 * ((size_t)numFaces + numBoundary) + 1) * sizeof(int));
+	positions = (float*)malloc((3 * ((size_t)numLocal + numBoundary) + 1) * sizeof(float));
+	locked = (char*)calloc(numLocal + numBoundary + 1, 1);
+	for(i = 0; i < numLocal; i++) {
+		memcpy(positions + 3 * i, o->positions + 3 * (size_t)verts[i], 3 * sizeof(float));
+		if(IS_SEAM(o->owner[verts[i]])) locked[i] = 1;
+	}
+	numCaps = capBoundaries(numFaces, indices, pairs, numLocal, positions, locked, &numGhosts);
+	free(pairs);
+
+	m = linkMesh(o->input, numLocal + numGhosts, positions, numFaces + numCaps, indices, -1, dimensions);
+	free(positions);
+	free(indices);
+
+	/* Remember the locked vertices by pointer, their slots change as the mesh is reduced */
+	lockedVerts = (Vertex**)malloc((numLocal + numGhosts + 1) * sizeof(Vertex*));
+	lockedId = (int*)malloc((numLocal + numGhosts + 1) * sizeof(int));
+	for(i = 0; i < numLocal + numGhosts; i++) {
+		if(!locked[i]) continue;
+		m->verts[i]->locked = 1;
+		lockedVerts[numLocked] = m->verts[i];
+		if(i >= numLocal) lockedId[numLocked] = GHOST;
+		else if(IS_SEAM(o->owner[verts[i]])) lockedId[numLocked] = SEAM_INDEX(o->owner[verts[i]]);
+		else lockedId[numLocked] = -1; /* Boundary of the input itself */
+		numLocked++;
+	}
+	changeCostFunc(m, cost);
+	reduceTo(m, numCaps + (int)(ratio * numFaces), 6, rounds);
+
+	finalId = (int*)malloc((m->numVertices + 1) * sizeof(int));
+	for(i = 0; i < m->numVertices; i++) finalId[i] = -1;
+	for(i = 0; i < numLocked; i++) finalId[lockedVerts[i]->index] = lockedId[i];
+	for(i = 0; i < m->numVertices; i++) {
+		if(finalId[i] == -1) {
+			float position[3];
+			position[0] = m->verts[i]->x;
+			position[1] = m->verts[i]->y;
+			position[2] = m->verts[i]->z;
+			fwrite(position, sizeof(float), 3, o->interiorFile);
+			finalId[i] = o->numSeams + o->numInterior++;
+		}
+	}
+	for(i = 0; i < m->numFaces; i++) {
+		Edge *edge = m->faces[i]->edge;
+		for(k = 0; k < 3; k++) {
+			id[k] = finalId[edge->vert->index];
+			edge = edge->next;
+		}
+		if(id[0] == GHOST || id[1] == GHOST || id[2] == GHOST) continue;
+		fwrite(id, sizeof(int), 3, o->stitchedFile);
+		numWritten++;
+	}
+	o->numStitched += numWritten;
+	printf("Chunk %d of %d: %d faces with %d locked boundary vertices, reduced to %d faces.\n",
+		chunk + 1, o->numChunks, numFaces, numLocked - numGhosts, numWritten);
+
+	destroyMesh(m);
+	free(verts);
+	free(locked);
+	free(lockedVerts);
+	free(lockedId);
+	free(finalId);
+}
+
+/**
+* Write the stitched chunks as they are, without loading them.
+*/
+void writeStitched(OutOfCore *o, FILE *f) {
+	float *positions = (float*)malloc(3 * OOC_BLOCK * sizeof(float));
+	int *indices = (int*)malloc(3 * OOC_BLOCK * sizeof(int));
+	int count, i, j, v;
+	fprintf(f, "OFF\n");
+	fprintf(f, "%d %d 0\n", o->numSeams + o->numInterior, o->numStitched);
+	for(v = 0; v < o->numVertices; v++) {
+		if(IS_SEAM(o->owner[v])) fprintf(f, "%f %f %f\n", o->positions[3 * v], o->positions[3 * v + 1], o->positions[3 * v + 2]);
+	}
+	rewind(o->interiorFile);
+	for(i = 0; i < o->numInterior; i += count) {
+		count = MIN(OOC_BLOCK, o->numInterior - i);
+		if(fread(positions, sizeof(float), 3 * count, o->interiorFile) != 3 * (size_t)count) break;
+		for(j = 0; j < count; j++) fprintf(f, "%f %f %f\n", positions[3 * j], positions[3 * j + 1], positions[3 * j + 2]);
+	}
+	rewind(o->stitchedFile);
+	for(i = 0; i < o->numStitched; i += count) {
+		count = MIN(OOC_BLOCK, o->numStitched - i);
+		if(fread(indices, sizeof(int), 3 * count, o->stitchedFile) != 3 * (size_t)count) break;
+		for(j = 0; j < count; j++) fprintf(f, "3 %d %d %d\n", indices[3 * j], indices[3 * j + 1], indices[3 * j + 2]);
+	}
+	free(positions);
+	free(indices);
+}
+
+/**
+* Join the reduced chunks along their seams. If the result fits in capacity faces it
+* is loaded and reduced to targetFaces across the seams, otherwise it is written as
+* it is. Returns the number of faces written.
+*/
+int stitchChunks(OutOfCore *o, int targetFaces, int capacity, float (*cost)(Edge*), int rounds) {
+	int numVerts = o->numSeams + o->numInterior, numFaces = o->numStitched, v;
+	float *positions, dimensions[6];
+	int *indices;
+	Mesh *m;
+	FILE *f = fopen(o->output, "w");
+	if(f == NULL) {
+		printf("Could not open file %s for writing.\n", o->output);
+		exit(2);
+	}
+	if(numFaces > capacity) {
+		printf("The %d stitched faces do not fit the memory budget, the seams are left as they are.\n", numFaces);
+		writeStitched(o, f);
+		fclose(f);
+		return numFaces;
+	}
+
+	positions = (float*)malloc((3 * (size_t)numVerts + 1) * sizeof(float));
+	indices = (int*)malloc((3 * (size_t)numFaces + 1) * sizeof(int));
+	for(v = 0; v < o->numVertices; v++) {
+		if(IS_SEAM(o->owner[v])) memcpy(positions + 3 * SEAM_INDEX(o->owner[v]), o->positions + 3 * (size_t)v, 3 * sizeof(float));
+	}
+	readScratch(o->interiorFile, positions + 3 * o->numSeams, 3 * (size_t)o->numInterior * sizeof(float), 0);
+	readScratch(o->stitchedFile, indices, 3 * (size_t)numFaces * sizeof(int), 0);
+	m = linkMesh(o->output, numVerts, positions, numFaces, indices, -1, dimensions);
+	free(positions);
+	free(indices);
+	changeCostFunc(m, cost);
+	reduceTo(m, targetFaces, 6, rounds);
+	printf("Stitched %d faces, reduced to %d faces across the seams.\n", numFaces, m->numFaces);
+	printMesh(m, f);
+	fclose(f);
+	numFaces = m->numFaces;
+	destroyMesh(m);
+	return numFaces;
+}
+
+/**
+* Simplify an OFF file too large to be loaded at once, to targetFaces faces or, if
+* that is negative, to ratio of its faces. The faces are split spatially into
+* chunks that fit the memory budget in bytes. Each chunk is reduced on its own
+* to OOC_HEADROOM times the target ratio, with the vertices it shares with other
+* chunks locked, and the reduced chunks are stitched back together and reduced to
+* the target across the seams. Everything but the chunk being reduced is kept in
+* scratch files next to output. Vertices not used by any face are dropped.
+* Returns the number of faces written.
+*/
+int simplifyOutOfCore(char *input, char *output, int targetFaces, float ratio, size_t budget,
+		float (*cost)(Edge*), int rounds) {
+	OutOfCore o;
+	int lo[3] = {0, 0, 0}, hi[3] = {OOC_GRID, OOC_GRID, OOC_GRID};
+	int capacity, chunk, faces, chunkTarget, defer = deferHeap;
+
+	memset(&o, 0, sizeof(o));
+	o.input = input;
+	o.output = output;
+	capacity = (int)MIN((size_t)INT_MAX, budget/OOC_BYTES_PER_FACE);
+	capacity = MAX(OOC_MIN_CHUNK, capacity);
+	o.positionFile = scratchFile(output);
+	o.ownerFile = scratchFile(output);
+	o.faceFile = scratchFile(output);
+	o.sortedFile = scratchFile(output);
+	o.interiorFile = scratchFile(output);
+	o.stitchedFile = scratchFile(output);
+
+	streamInput(&o);
+	if(targetFaces < 0) targetFaces = ratio * o.numFaces;
+	o.cellChunk = (int*)malloc(OOC_GRID * OOC_GRID * OOC_GRID * sizeof(int));
+	splitCells(&o, lo, hi, capacity);
+	printf("Split into %d chunks of at most %d faces.\n", o.numChunks, capacity);
+	sortFaces(&o);
+	/* Chunks keep headroom for the stitched pass to spend across the seams, as long as it still fits */
+	chunkTarget = MAX(targetFaces, (int)MIN((double)OOC_HEADROOM * targetFaces, OOC_STITCH_FILL * capacity));
+	deferHeap = 1; /* Chunk heaps are built once their seams are locked */
+	for(chunk = 0; chunk < o.numChunks; chunk++) {
+		simplifyChunk(&o, chunk, o.numFaces > 0 ? MIN(1.0f, (float)chunkTarget/o.numFaces) : 1.0f, cost, rounds);
+	}
+	fflush(o.interiorFile);
+	fflush(o.stitchedFile);
+	faces = stitchChunks(&o, targetFaces, capacity, cost, rounds);
+	deferHeap = defer;
+
+	munmap(o.positions, MAX(1, 3 * (size_t)o.numVertices * sizeof(float)));
+	munmap(o.owner, MAX(1, (size_t)o.numVertices * sizeof(int)));
+	fclose(o.positionFile);
+	fclose(o.ownerFile);
+	fclose(o.faceFile);
+	fclose(o.sortedFile);
+	fclose(o.interiorFile);
+	fclose(o.stitchedFile);
+	free(o.cellFaces);
+	free(o.cellChunk);
+	free(o.chunkFaces);
+	free(o.chunkStart);
+	return faces;
+}
@@ -0,0 +1,38 @@
+#ifndef __OUTOFCORE_H__
+#define __OUTOFCORE_H__
+
+#include <stdio.h>
+#include "types.h"
+#include "mesh.h"
+
+#define OOC_BYTES_PER_FACE 400 /* Memory used per face by a loaded and reduced mesh, heap included */
+#define OOC_GRID 64 /* Cells per axis of the histogram chunks are cut from */
+#define OOC_HEADROOM 2 /* Chunks are reduced to this multiple of the target, the stitched pass does the rest */
+#define OOC_STITCH_FILL 0.95 /* Share of the budget the headroom may fill, the stitched faces overshoot a little */
+
+/**
+* State of an out of core simplification. The input positions and the chunk
+* of every vertex live in mapped scratch files, so only the histogram, one
+* chunk and its buffers are held in memory at a time.
+*/
+typedef struct _outofcore {
+	char *input, *output;
+	int numVertices, numFaces;
+	float bounds[6]; /* min x, max x, min y, max y, min z, max z */
+	float *positions; /* Mapped copy of the input positions */
+	int *owner; /* Chunk using each vertex, OWNER_NONE, OWNER_SHARED or a seam id */
+	int *cellFaces; /* Faces whose centroid falls in each histogram cell */
+	int *cellChunk; /* Chunk of each histogram cell */
+	int numChunks;
+	int *chunkFaces;
+	long long *chunkStart; /* First face of each chunk in the sorted face file */
+	int numSeams; /* Vertices used by faces of several chunks */
+	int numInterior; /* Vertices written by the chunks besides the seams */
+	int numStitched; /* Faces written by the chunks */
+	FILE *positionFile, *ownerFile, *faceFile, *sortedFile, *interiorFile, *stitchedFile;
+} OutOfCore;
+
+int simplifyOutOfCore(char *input, char *output, int targetFaces, float ratio, size_t budget,
+	float (*cost)(Edge*), int rounds);
+
+#endif
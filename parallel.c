@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "parallel.h"
+
+typedef struct _parallelrange {
+	void (*body)(void*, int, int);
+	void *arg;
+	int start, end;
+} ParallelRange;
+
+void *parallelRange(void *arg) {
+	ParallelRange *range = (ParallelRange*)arg;
+	(*range->body)(range->arg, range->start, range->end);
+	return NULL;
+}
+
+/**
+* Split [0, count) into one contiguous range per thread and run body on each,
+* returning once every range is done. The calling thread takes the first range.
+*/
+void parallelFor(int count, int threads, void (*body)(void *arg, int start, int end), void *arg) {
+	ParallelRange *ranges;
+	pthread_t *ids;
+	int i;
+	if(threads > count) threads = count;
+	if(threads <= 1) {
+		if(count > 0) (*body)(arg, 0, count);
+		return;
+	}
+	ranges = (ParallelRange*)malloc(threads * sizeof(ParallelRange));
+	ids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	for(i = 0; i < threads; i++) {
+		ranges[i].body = body;
+		ranges[i].arg = arg;
+		ranges[i].start = (int)((long long)count * i / threads);
+		ranges[i].end = (int)((long long)count * (i + 1) / threads);
+	}
+	for(i = 1; i < threads; i++) pthread_create(&ids[i], NULL, parallelRange, &ranges[i]);
+	parallelRange(&ranges[0]);
+	for(i = 1; i < threads; i++) pthread_join(ids[i], NULL);
+	free(ranges);
+	free(ids);
+}
@@ -0,0 +1,6 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+void parallelFor(int count, int threads, void (*body)(void *arg, int start, int end), void *arg);
+
+#endif
@@ -0,0 +1,66 @@
+#include "pool.h"
+#include "stats.h"
+
+#define POOL_MIN_BLOCK 64
+
+/**
+* Initialize a slab allocator handing out elements of the given size. Elements
+* are carved from blocks of blockElements elements, so sizing the first block to
+* the expected element count makes loading a mesh a single allocation per type.
+*/
+void initPool(Pool *p, size_t elementSize, int blockElements) {
+	/* Keep every element aligned for pointers and doubles, and large enough to hold a free list link */
+	elementSize = (elementSize + sizeof(double) - 1)/sizeof(double) * sizeof(double);
+	if(elementSize < sizeof(void*)) elementSize = sizeof(void*);
+	p->elementSize = elementSize;
+	p->blockElements = blockElements < POOL_MIN_BLOCK ? POOL_MIN_BLOCK : blockElements;
+	p->used = p->blockElements;
+	p->numBlocks = 0;
+	p->blockCapacity = 0;
+	p->blocks = NULL;
+	p->freeList = NULL;
+}
+
+/**
+* Release every element of the pool at once.
+*/
+void destroyPool(Pool *p) {
+	int i;
+	STATS_MEMORY(-(long long)(p->numBlocks * p->blockElements * p->elementSize));
+	for(i = 0; i < p->numBlocks; i++) free(p->blocks[i]);
+	free(p->blocks);
+	p->blocks = NULL;
+	p->numBlocks = 0;
+	p->blockCapacity = 0;
+	p->used = p->blockElements;
+	p->freeList = NULL;
+}
+
+void *poolAlloc(Pool *p) {
+	void *element;
+	if(p->freeList != NULL) {
+		element = p->freeList;
+		p->freeList = *(void**)element;
+		return element;
+	}
+	if(p->used == p->blockElements) {
+		if(p->numBlocks == p->blockCapacity) {
+			p->blockCapacity = p->blockCapacity == 0 ? 8 : 2 * p->blockCapacity;
+			p->blocks = (char**)realloc(p->blocks, p->blockCapacity * sizeof(char*));
+		}
+		p->blocks[p->numBlocks++] = (char*)malloc(p->blockElements * p->elementSize);
+		STATS_MEMORY(p->blockElements * p->elementSize);
+		p->used = 0;
+	}
+	element = p->blocks[p->numBlocks - 1] + p->used * p->elementSize;
+	p->used += 1;
+	return element;
+}
+
+/**
+* Return an element to the pool. The slot is reused by the next poolAlloc.
+*/
+void poolFree(Pool *p, void *element) {
+	*(void**)element = p->freeList;
+	p->freeList = element;
+}
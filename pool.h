@@ -0,0 +1,13 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdlib.h>
+#include "types.h"
+
+void initPool(Pool *p, size_t elementSize, int blockElements);
+void destroyPool(Pool *p);
+
+void *poolAlloc(Pool *p);
+void poolFree(Pool *p, void *element);
+
+#endif
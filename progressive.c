@@ -0,0 +1,262 @@
+#include "progressive.h"
+
+/**
+* Start logging every collapse of m, with the flips done after it, so that the
+* mesh can later be moved between levels of detail without simplifying again.
+* Elements cut out by a recorded collapse stay allocated until recording stops.
+*/
+void startRecording(Mesh *m) {
+	Recorder *r;
+	if(m->recorder != NULL) return;
+	r = (Recorder*)malloc(sizeof(Recorder));
+	r->capacity = 64;
+	r->numRecords = 0;
+	r->current = 0;
+	r->records = (CollapseRecord*)malloc(r->capacity * sizeof(CollapseRecord));
+	r->flips.capacity = 64;
+	r->flips.numFlips = 0;
+	r->flips.flips = (FlipRecord*)malloc(r->flips.capacity * sizeof(FlipRecord));
+	r->detached = 0;
+	m->recorder = r;
+}
+
+/**
+* Drop the history, keeping the mesh at its current level of detail, and release
+* the elements cut out by the applied collapses.
+*/
+void stopRecording(Mesh *m) {
+	Recorder *r = m->recorder;
+	int i;
+	if(r == NULL) return;
+	for(i = 0; i < r->current; i++) {
+		Edge *e = r->records[i].edge;
+		Edge *b1 = e->next;
+		Edge *d1 = e->pair->prev;
+		poolFree(&m->edgePool, b1->pair);
+		poolFree(&m->edgePool, d1->pair);
+		poolFree(&m->edgePool, b1);
+		poolFree(&m->edgePool, d1);
+		poolFree(&m->facePool, e->face);
+		poolFree(&m->facePool, e->pair->face);
+		poolFree(&m->vertPool, e->vert);
+		poolFree(&m->edgePool, e->pair);
+		poolFree(&m->edgePool, e);
+	}
+	if(r->detached) rebuildHeap(m->heap);
+	free(r->records);
+	free(r->flips.flips);
+	free(r);
+	m->recorder = NULL;
+}
+
+/**
+* Prepare the history for new collapses. Undone records are discarded, since the
+* mesh is about to take a different path, and the heap is rebuilt if a replay
+* emptied it.
+*/
+void resumeRecording(Mesh *m) {
+	Recorder *r = m->recorder;
+	r->numRecords = r->current;
+	r->flips.numFlips = r->current > 0 ? r->records[r->current - 1].flipEnd : 0;
+	if(r->detached) {
+		rebuildHeap(m->heap);
+		r->detached = 0;
+	}
+}
+
+void appendFlip(FlipLog *log, const FlipRecord *flip) {
+	if(log->numFlips == log->capacity) {
+		log->capacity = log->capacity == 0 ? 16 : 2 * log->capacity;
+		log->flips = (FlipRecord*)realloc(log->flips, log->capacity * sizeof(FlipRecord));
+	}
+	log->flips[log->numFlips++] = *flip;
+}
+
+/**
+* Make room for count records after the applied ones and return the first slot.
+*/
+CollapseRecord *reserveRecords(Mesh *m, int count) {
+	Recorder *r = m->recorder;
+	if(r->current + count > r->capacity) {
+		while(r->current + count > r->capacity) r->capacity *= 2;
+		r->records = (CollapseRecord*)realloc(r->records, r->capacity * sizeof(CollapseRecord));
+	}
+	return r->records + r->current;
+}
+
+/**
+* Append count reserved records, each with the flips collected in its own log,
+* to the history. The per collapse logs are released.
+*/
+void commitRecords(Mesh *m, int count, FlipLog *flips) {
+	Recorder *r = m->recorder;
+	int i, j;
+	for(i = 0; i < count; i++) {
+		for(j = 0; j < flips[i].numFlips; j++) appendFlip(&r->flips, &flips[i].flips[j]);
+		free(flips[i].flips);
+		r->records[r->current++].flipEnd = r->flips.numFlips;
+	}
+	r->numRecords = r->current;
+}
+
+/**
+* Contract e and run the Delaunay pass around the result, describing the
+* collapse in r and appending its flips to the given log.
+*/
+Vertex *contractRecorded(Mesh *m, Edge *e, CollapseRecord *r, FlipLog *flips) {
+	Vertex *p = e->pair->vert;
+	r->edge = e;
+	r->from[0] = p->x;
+	r->from[1] = p->y;
+	r->from[2] = p->z;
+	memcpy(r->quadric, p->quadric, sizeof(r->quadric));
+	r->links = contractLinks(e);
+	contractEdge(m, e);
+	localDelaunay(p, flips);
+	r->to[0] = p->x;
+	r->to[1] = p->y;
+	r->to[2] = p->z;
+	return p;
+}
+
+/**
+* Collapse e, as collapseEdge followed by localDelaunay, and add it to the history.
+*/
+Vertex *recordCollapse(Mesh *m, Edge *e) {
+	Recorder *r = m->recorder;
+	CollapseRecord *record = reserveRecords(m, 1);
+	Vertex *p = contractRecorded(m, e, record, &r->flips);
+	record->flipEnd = r->flips.numFlips;
+	r->current++;
+	r->numRecords = r->current;
+	removeContracted(m, e);
+	return p;
+}
+
+/**
+* Empty the heap without evaluating any costs. Replays change the mesh under the
+* heap, so it is only rebuilt once reduction continues.
+*/
+void detachHeap(Mesh *m) {
+	Heap *h = m->heap;
+	int i;
+	if(m->recorder->detached) return;
+	for(i = 0; i < h->size; i++) m->edges[h->heap[i].edge]->heapIndex = -1;
+	h->size = 0;
+	m->recorder->detached = 1;
+}
+
+/**
+* Mark the faces around v as needing new normals.
+*/
+void staleRing(Vertex *v) {
+	Edge *edge = v->edge;
+	do {
+		edge->face->stale = 1;
+		edge = edge->pair->prev;
+	} while(edge != v->edge);
+}
+
+/**
+* Undo the last applied collapse, splitting its vertex again. Returns 0 if
+* there is nothing to undo.
+*/
+int undoCollapse(Mesh *m) {
+	Recorder *r = m->recorder;
+	CollapseRecord *record;
+	Edge *e, *a, *b1, *b2, *c, *d1, *d2, *edge;
+	Vertex *p, *q;
+	int i, flipStart;
+	if(r == NULL || r->current == 0) return 0;
+	detachHeap(m);
+	record = &r->records[--r->current];
+	flipStart = r->current > 0 ? r->records[r->current - 1].flipEnd : 0;
+
+	e = record->edge;
+	a = e->prev;
+	b1 = e->next;
+	b2 = b1->pair;
+	c = e->pair->next;
+	d1 = e->pair->prev;
+	d2 = d1->pair;
+	p = e->pair->vert;
+	q = e->vert;
+
+	/* Put the cut out elements back in the reverse order of removeContracted */
+	restoreEdge(m, e);
+	restoreEdge(m, e->pair);
+	restoreVert(m, q);
+	restoreFace(m, e->pair->face);
+	restoreFace(m, e->face);
+	restoreEdge(m, d2);
+	restoreEdge(m, b2);
+	restoreEdge(m, d1);
+	restoreEdge(m, b1);
+
+	for(i = record->flipEnd - 1; i >= flipStart; i--) undoFlip(&r->flips.flips[i]);
+
+	/* Re link left and right side triangles, the cut out edges still hold their old links */
+	b2->prev->next = b2;
+	b2->next->prev = b2;
+	a->prev = b1;
+	a->next = e;
+	a->face = e->face;
+	d2->prev->next = d2;
+	d2->next->prev = d2;
+	c->prev = e->pair;
+	c->next = d1;
+	c->face = e->pair->face;
+	if(record->links & CONTRACT_LEFT_FACE) b2->face->edge = b2;
+	if(record->links & CONTRACT_LEFT_VERT) b1->vert->edge = b1;
+	if(record->links & CONTRACT_RIGHT_FACE) d2->face->edge = d2;
+	if(record->links & CONTRACT_RIGHT_VERT) c->vert->edge = d2;
+	if(record->links & CONTRACT_TAIL) p->edge = e->pair;
+
+	/* Give Q back the edges incident at it, now that its ring is linked again */
+	edge = d1;
+	do {
+		edge = edge->pair->prev;
+		edge->vert = q;
+	} while(edge != b2);
+
+	p->x = record->from[0];
+	p->y = record->from[1];
+	p->z = record->from[2];
+	p->snapshot = -1;
+	memcpy(p->quadric, record->quadric, sizeof(record->quadric));
+	staleRing(p);
+	staleRing(q);
+	logVertex(m, p);
+	logVertex(m, q);
+	return 1;
+}
+
+/**
+* Apply the next undone collapse again. Returns 0 if there is nothing to redo.
+*/
+int redoCollapse(Mesh *m) {
+	Recorder *r = m->recorder;
+	CollapseRecord *record;
+	int i;
+	if(r == NULL || r->current == r->numRecords) return 0;
+	detachHeap(m);
+	record = &r->records[r->current];
+	i = r->current > 0 ? r->records[r->current - 1].flipEnd : 0;
+	contractEdgeTo(record->edge, record->to);
+	for(; i < record->flipEnd; i++) edgeFlip(r->flips.flips[i].edge);
+	removeContracted(m, record->edge);
+	logVertex(m, record->edge->pair->vert);
+	r->current++;
+	return 1;
+}
+
+/**
+* Move through the history to the first recorded level with at most numFaces
+* faces, or to the nearest end of the history. Costs are not evaluated, the
+* heap is rebuilt if reduction continues afterwards. Returns the face count reached.
+*/
+int seekFaces(Mesh *m, int numFaces) {
+	while(m->numFaces < numFaces && undoCollapse(m));
+	while(m->numFaces > numFaces && redoCollapse(m));
+	return m->numFaces;
+}
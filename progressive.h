@@ -0,0 +1,22 @@
+#ifndef __PROGRESSIVE_H__
+#define __PROGRESSIVE_H__
+
+#include "types.h"
+#include "mesh.h"
+
+void startRecording(Mesh *m);
+void stopRecording(Mesh *m);
+void resumeRecording(Mesh *m);
+
+void appendFlip(FlipLog *log, const FlipRecord *flip);
+CollapseRecord *reserveRecords(Mesh *m, int count);
+void commitRecords(Mesh *m, int count, FlipLog *flips);
+Vertex *contractRecorded(Mesh *m, Edge *e, CollapseRecord *r, FlipLog *flips);
+Vertex *recordCollapse(Mesh *m, Edge *e);
+
+void detachHeap(Mesh *m);
+int undoCollapse(Mesh *m);
+int redoCollapse(Mesh *m);
+int seekFaces(Mesh *m, int numFaces);
+
+#endif
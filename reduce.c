@@ -4,12 +4,18 @@
 #include <sys/time.h>
 #endif
 
+#include <limits.h>
+#include <pthread.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <GL/glut.h>
 
 #include "heap.h"
 #include "meshio.h"
+#include "progressive.h"
+#include "render.h"
+#include "reorder.h"
+#include "stats.h"
 
 #define __UNUSED(x) (void)x;
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -19,6 +25,10 @@
 #define SCENE_SPEED 1.0f
 #define CLOCK_RATE 1000
 #define MODEL_FILE "camel.off"
+#define PUBLISH_INTERVAL 30 /* Default milliseconds of reduction between snapshots */
+#define PUBLISH_RATIO 10 /* Least ratio of reduction time to the time spent publishing */
+#define POLL_INTERVAL 16 /* Milliseconds between checks for a new snapshot while reducing */
+#define KEY_ESCAPE 27
 
 char* fileName;
 int width = WINDOW_START_WIDTH;
@@ -30,6 +40,16 @@ int lines;
 float dimensions[6];
 Mesh *mesh;
 Heap *heap;
+RenderBuffer *buffer;
+SnapshotExchange *snapshots;
+long publishInterval = PUBLISH_INTERVAL * 1000L;
+
+/* Background reduction. While reducing is set the worker owns the mesh and buffer */
+pthread_t worker;
+ReduceLimits pending;
+int reducing = 0, reduction = 0, initEdges, initPolys;
+int cancelled, finished; /* Accessed atomically, set by the viewer and the worker */
+char reducingKey;
 
 GLfloat lightMat[] = {1.0, 0.0, 0.0, 1.0}; 
 GLfloat lightPos[] = {1.0, 1.0, 1.0, 0.0};  /* Infinite light location. */
@@ -75,29 +95,25 @@ void reshape(GLint newWidth, GLint newHeight) {
 	glutPostRedisplay();
 }
 
+/**
+* Draw the latest snapshot, which the worker never writes while it is held.
+*/
 void render(void) {
-	int i;
-	Edge *edge;
-	float normal[3];
+	RenderSnapshot *snapshot = latestSnapshot(snapshots);
 	glPushMatrix();
 	glTranslatef((dimensions[0] + dimensions[1])/2.0f, (dimensions[2] + dimensions[3])/2.0f, (dimensions[4] + dimensions[5])/2.0f);
 	glRotatef(yrot, 1.0f, 0.0f, 0.0f);
 	glRotatef(xrot, 0.0f, 1.0f, 0.0f);
 	glTranslatef(-(dimensions[0] + dimensions[1])/2.0f, -(dimensions[2] + dimensions[3])/2.0f, -(dimensions[4] + dimensions[5])/2.0f);
 	
-	glBegin(GL_TRIANGLES);
-	for(i = 0; i < mesh->numFaces; i++) {
-		faceNormal(mesh->faces[i], normal);
-		edge = mesh->faces[i]->edge;
-		do {
-			glNormal3f(normal[0], normal[1], normal[2]);
-			glVertex3f(edge->vert->x, edge->vert->y, edge->vert->z);
-			edge = edge->next;
-		}
-		while(edge != mesh->faces[i]->edge);
-	}
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, snapshot->positions);
+	glNormalPointer(GL_FLOAT, 0, snapshot->normals);
+	glDrawElements(GL_TRIANGLES, 3 * snapshot->numFaces, GL_UNSIGNED_INT, snapshot->indices);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
 	glPopMatrix();
-	glEnd();
 }
 
 void draw(float timeDelta) {
@@ -134,17 +150,95 @@ void tick(void) {
 	lastTick = curTick;
 }
 
+/**
+* Bring the buffer up to date with the mesh and hand a copy to render.
+*/
+void publishMesh() {
+	updateRenderBuffer(buffer, mesh);
+	publishSnapshot(snapshots, buffer);
+}
+
+/**
+* Worker thread reducing towards the pending limits. A snapshot is published
+* after every slice of publishInterval, or longer on meshes where publishing is
+* slow, so that copying stays a small share of the time spent reducing.
+*/
+void *reduceWorker(void *arg) {
+	ReduceLimits limits = pending;
+	unsigned long long start;
+	int reason;
+	__UNUSED(arg);
+	do {
+		reason = reduceUntil(mesh, &limits, NULL);
+		start = statsNow();
+		publishMesh();
+		limits.budget = MAX(publishInterval, PUBLISH_RATIO * (long)((statsNow() - start)/1000));
+	} while(reason == REDUCE_TIME && !__atomic_load_n(&cancelled, __ATOMIC_ACQUIRE));
+	__atomic_store_n(&finished, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/**
+* Timer callback redrawing whenever the worker has published, until it is done.
+* The value is the reduction the timer was set for, so stale timers stop.
+*/
+void pollReduction(int value) {
+	if(!reducing || value != reduction) return;
+	if(snapshotFresh(snapshots)) glutPostRedisplay();
+	if(__atomic_load_n(&finished, __ATOMIC_ACQUIRE)) {
+		pthread_join(worker, NULL);
+		reducing = 0;
+		printf("Mesh successfully reduced by %c0%%. From %d to %d edges, %d to %d polys.\n",
+			reducingKey, initEdges, mesh->numEdges, initPolys, mesh->numFaces);
+	}
+	else glutTimerFunc(POLL_INTERVAL, pollReduction, reduction);
+}
+
+void startReducing(char key, int targetEdges) {
+	pending.targetFaces = 0;
+	pending.targetEdges = targetEdges;
+	pending.maxCost = INFINITY;
+	pending.budget = publishInterval;
+	pending.rounds = 0;
+	reducingKey = key;
+	cancelled = finished = 0;
+	reducing = 1;
+	reduction++;
+	pthread_create(&worker, NULL, reduceWorker, NULL);
+	glutTimerFunc(POLL_INTERVAL, pollReduction, reduction);
+}
+
+/**
+* Cancel the reduction in progress, if any, and wait for the worker to finish
+* its current slice so the mesh can be used again.
+*/
+void stopReducing() {
+	if(!reducing) return;
+	__atomic_store_n(&cancelled, 1, __ATOMIC_RELEASE);
+	pthread_join(worker, NULL);
+	reducing = 0;
+	printf("Reduction stopped at %d polys.\n", mesh->numFaces);
+}
+
 void deallocate(void) {
+	stopReducing();
+	destroySnapshotExchange(snapshots);
+	destroyRenderBuffer(buffer, mesh);
 	destroyMesh(mesh);
 }
 
+/**
+* Go back to the loaded mesh by undoing every recorded collapse.
+*/
 void reset() {
-	mesh = readMesh(fileName, dimensions);
+	seekFaces(mesh, INT_MAX);
 }
 
 void keyboardInput(unsigned char key, int x, int y) {
 	__UNUSED(x);
 	__UNUSED(y);
+	/* Anything but the view keys touches the mesh, which is the worker's while reducing */
+	if(key != 'v' && key != '+' && key != '-') stopReducing();
 	switch(key) {
 		case '1':
 		case '2':
@@ -155,20 +249,26 @@ void keyboardInput(unsigned char key, int x, int y) {
 		case '7':
 		case '8':
 		case '9': {
-			int initEdges = mesh->numEdges;
-			int initPolys = mesh->numFaces;
 			int targetEdges = MAX(6, (1.0f - 0.1f * (int)(key - '0')) * mesh->numEdges);
+			initEdges = mesh->numEdges;
+			initPolys = mesh->numFaces;
+			/* Replay collapses undone earlier before computing new ones */
 			while(mesh->numEdges > targetEdges) {
-				if(!reduce(mesh)) break;
+				if(!redoCollapse(mesh)) break;
 			}
-			printf("Mesh successfully reduced by %c0%%. From %d to %d edges, %d to %d polys.\n",
-				key, initEdges, mesh->numEdges, initPolys, mesh->numFaces);
+			startReducing(key, targetEdges);
 			break;
 		}
 		case '`':
 			reduce(mesh);
 			printf("Mesh successfully reduced by one vertex.\n");
 			break;
+		case '[':
+			if(undoCollapse(mesh)) printf("Collapse undone, %d polys.\n", mesh->numFaces);
+			break;
+		case ']':
+			if(redoCollapse(mesh)) printf("Collapse redone, %d polys.\n", mesh->numFaces);
+			break;
 		case 'v':
 			lines = 1 - lines;
 			printf("Display mode changed. ");
@@ -193,6 +293,12 @@ void keyboardInput(unsigned char key, int x, int y) {
 			changeCostFunc(mesh, simpleCost);
 			printf("Cost function changed to Simple.\n");
 			break;
+		case 'g':
+			changeCostFunc(mesh, garlandCost);
+			printf("Cost function changed to Garland.\n");
+			break;
+		case KEY_ESCAPE: /* Already cancelled above */
+			break;
 		case '+':
 			zoom += 1;
 			break;
@@ -202,6 +308,7 @@ void keyboardInput(unsigned char key, int x, int y) {
 		default: break;
 
 	}
+	if(!reducing) publishMesh();
 	glutPostRedisplay();
 }
 
@@ -237,8 +344,14 @@ int main(int argc, char** argv) {
 		fileName[0] = 0;
 		strcat(fileName, argv[1]);
 	}
+	if(argc > 2) meshThreads = MAX(1, atoi(argv[2]));
+	if(argc > 3) publishInterval = MAX(1, atoi(argv[3])) * 1000L;
 	
 	mesh = readMesh(fileName, dimensions);
+	reorderMesh(mesh, dimensions);
+	startRecording(mesh);
+	buffer = initRenderBuffer(mesh);
+	snapshots = initSnapshotExchange(buffer);
 	//keyboardInput('9', 0, 0);
 	
 	atexit(deallocate);
@@ -0,0 +1,237 @@
+#include <string.h>
+#include "render.h"
+
+/**
+* Build render buffers for m and start logging the changes made to it, so that
+* updateRenderBuffer only has to patch what changed. Only one render buffer may
+* be attached to a mesh at a time.
+*/
+RenderBuffer *initRenderBuffer(Mesh *m) {
+	RenderBuffer *rb = (RenderBuffer*)malloc(sizeof(RenderBuffer));
+	ChangeLog *log = (ChangeLog*)malloc(sizeof(ChangeLog));
+	log->vertCapacity = 64;
+	log->numVerts = 0;
+	log->verts = (Vertex**)malloc(log->vertCapacity * sizeof(Vertex*));
+	log->faceCapacity = 64;
+	log->numFaces = 0;
+	log->faces = (Face**)malloc(log->faceCapacity * sizeof(Face*));
+	m->changes = log;
+
+	rb->numVertices = rb->numFaces = 0;
+	rb->vertCapacity = rb->faceCapacity = 0;
+	rb->positions = rb->normals = NULL;
+	rb->indices = NULL;
+	rb->epoch = 0;
+	rb->marks = NULL;
+	rb->pending = NULL;
+	rb->numPending = 0;
+	buildRenderBuffer(rb, m);
+	return rb;
+}
+
+void destroyRenderBuffer(RenderBuffer *rb, Mesh *m) {
+	if(m->changes != NULL) {
+		free(m->changes->verts);
+		free(m->changes->faces);
+		free(m->changes);
+		m->changes = NULL;
+	}
+	free(rb->positions);
+	free(rb->normals);
+	free(rb->indices);
+	free(rb->marks);
+	free(rb->pending);
+	free(rb);
+}
+
+void writePosition(RenderBuffer *rb, Vertex *v) {
+	float *p = rb->positions + 3 * v->index;
+	p[0] = v->x;
+	p[1] = v->y;
+	p[2] = v->z;
+}
+
+/**
+* Write the indices of f and queue its vertices for a normal refresh.
+*/
+void writeFace(RenderBuffer *rb, Face *f) {
+	uint32_t *indices = rb->indices + 3 * f->index;
+	Edge *edge = f->edge;
+	int i;
+	for(i = 0; i < 3; i++) {
+		Vertex *v = edge->vert;
+		indices[i] = v->index;
+		if(rb->marks[v->index] != rb->epoch) {
+			rb->marks[v->index] = rb->epoch;
+			rb->pending[rb->numPending++] = v->index;
+		}
+		edge = edge->next;
+	}
+}
+
+void writeNormal(RenderBuffer *rb, Vertex *v) {
+	float *normal = rb->normals + 3 * v->index;
+	float n[3], len;
+	Edge *edge = v->edge;
+	normal[0] = normal[1] = normal[2] = 0.0f;
+	if(edge == NULL) return; /* No face uses the vertex */
+	do {
+		faceNormal(edge->face, n);
+		if(n[0] == n[0] && n[1] == n[1] && n[2] == n[2]) { /* Skip degenerate faces */
+			normal[0] += n[0];
+			normal[1] += n[1];
+			normal[2] += n[2];
+		}
+		edge = edge->pair->prev;
+	} while(edge != v->edge);
+	len = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	if(len > 0.0f) {
+		normal[0] /= len;
+		normal[1] /= len;
+		normal[2] /= len;
+	}
+}
+
+/**
+* Rewrite every entry of the buffers from m and forget the logged changes.
+*/
+void buildRenderBuffer(RenderBuffer *rb, Mesh *m) {
+	int i;
+	if(m->numVertices > rb->vertCapacity) {
+		rb->vertCapacity = m->numVertices;
+		rb->positions = (float*)realloc(rb->positions, 3 * (size_t)rb->vertCapacity * sizeof(float));
+		rb->normals = (float*)realloc(rb->normals, 3 * (size_t)rb->vertCapacity * sizeof(float));
+		rb->marks = (unsigned int*)realloc(rb->marks, rb->vertCapacity * sizeof(unsigned int));
+		rb->pending = (int*)realloc(rb->pending, rb->vertCapacity * sizeof(int));
+		memset(rb->marks, 0, rb->vertCapacity * sizeof(unsigned int));
+		rb->epoch = 0;
+	}
+	if(m->numFaces > rb->faceCapacity) {
+		rb->faceCapacity = m->numFaces;
+		rb->indices = (uint32_t*)realloc(rb->indices, 3 * (size_t)rb->faceCapacity * sizeof(uint32_t));
+	}
+	rb->numVertices = m->numVertices;
+	rb->numFaces = m->numFaces;
+	for(i = 0; i < m->numVertices; i++) {
+		writePosition(rb, m->verts[i]);
+		writeNormal(rb, m->verts[i]);
+	}
+	for(i = 0; i < m->numFaces; i++) {
+		Edge *edge = m->faces[i]->edge;
+		rb->indices[3 * i] = edge->vert->index;
+		rb->indices[3 * i + 1] = edge->next->vert->index;
+		rb->indices[3 * i + 2] = edge->next->next->vert->index;
+	}
+	if(m->changes != NULL) m->changes->numVerts = m->changes->numFaces = 0;
+}
+
+/**
+* Bring the buffers up to date with m, patching only the entries of the logged
+* vertices and faces. Falls back to a full build when most of the mesh changed.
+*/
+void updateRenderBuffer(RenderBuffer *rb, Mesh *m) {
+	ChangeLog *log = m->changes;
+	Edge *edge, *second;
+	int i;
+	if(log->numVerts == 0 && log->numFaces == 0) return;
+	if(m->numVertices > rb->vertCapacity || m->numFaces > rb->faceCapacity ||
+		8 * (log->numVerts + log->numFaces) > m->numFaces) {
+		buildRenderBuffer(rb, m);
+		return;
+	}
+	if(++rb->epoch == 0) {
+		memset(rb->marks, 0, rb->vertCapacity * sizeof(unsigned int));
+		rb->epoch = 1;
+	}
+	rb->numPending = 0;
+	rb->numVertices = m->numVertices;
+	rb->numFaces = m->numFaces;
+
+	/* Logged elements may have been deleted since, so skip the ones no longer in their slot */
+	for(i = 0; i < log->numFaces; i++) {
+		Face *f = log->faces[i];
+		if(f->index >= 0 && f->index < m->numFaces && m->faces[f->index] == f) writeFace(rb, f);
+	}
+	for(i = 0; i < log->numVerts; i++) {
+		Vertex *v = log->verts[i];
+		if(v->index < 0 || v->index >= m->numVertices || m->verts[v->index] != v) continue;
+		writePosition(rb, v);
+		if(v->edge == NULL) continue;
+		edge = v->edge;
+		do {
+			second = edge->pair;
+			do {
+				writeFace(rb, second->face);
+				second = second->pair->prev;
+			} while(second != edge->pair);
+			edge = edge->pair->prev;
+		} while(edge != v->edge);
+	}
+	for(i = 0; i < rb->numPending; i++) writeNormal(rb, m->verts[rb->pending[i]]);
+	log->numVerts = log->numFaces = 0;
+}
+
+/**
+* Create an exchange whose reader starts out with a snapshot of rb.
+*/
+SnapshotExchange *initSnapshotExchange(RenderBuffer *rb) {
+	SnapshotExchange *x = (SnapshotExchange*)calloc(1, sizeof(SnapshotExchange));
+	x->back = 0;
+	x->shared = 1;
+	x->front = 2;
+	publishSnapshot(x, rb);
+	latestSnapshot(x);
+	return x;
+}
+
+void destroySnapshotExchange(SnapshotExchange *x) {
+	int i;
+	for(i = 0; i < 3; i++) {
+		free(x->snapshots[i].positions);
+		free(x->snapshots[i].normals);
+		free(x->snapshots[i].indices);
+	}
+	free(x);
+}
+
+/**
+* Copy rb into the writer's snapshot and swap it into the shared slot. Only one
+* thread may publish at a time.
+*/
+void publishSnapshot(SnapshotExchange *x, RenderBuffer *rb) {
+	RenderSnapshot *s = &x->snapshots[x->back];
+	if(rb->numVertices > s->vertCapacity) {
+		s->vertCapacity = rb->vertCapacity;
+		s->positions = (float*)realloc(s->positions, 3 * (size_t)s->vertCapacity * sizeof(float));
+		s->normals = (float*)realloc(s->normals, 3 * (size_t)s->vertCapacity * sizeof(float));
+	}
+	if(rb->numFaces > s->faceCapacity) {
+		s->faceCapacity = rb->faceCapacity;
+		s->indices = (uint32_t*)realloc(s->indices, 3 * (size_t)s->faceCapacity * sizeof(uint32_t));
+	}
+	s->numVertices = rb->numVertices;
+	s->numFaces = rb->numFaces;
+	memcpy(s->positions, rb->positions, 3 * (size_t)rb->numVertices * sizeof(float));
+	memcpy(s->normals, rb->normals, 3 * (size_t)rb->numVertices * sizeof(float));
+	memcpy(s->indices, rb->indices, 3 * (size_t)rb->numFaces * sizeof(uint32_t));
+	/* Release the copy and take back whatever was in the slot, read or not */
+	x->back = __atomic_exchange_n(&x->shared, x->back | SNAPSHOT_FRESH, __ATOMIC_ACQ_REL) & ~SNAPSHOT_FRESH;
+}
+
+/**
+* Whether a snapshot was published since the reader last took one.
+*/
+int snapshotFresh(SnapshotExchange *x) {
+	return (__atomic_load_n(&x->shared, __ATOMIC_ACQUIRE) & SNAPSHOT_FRESH) != 0;
+}
+
+/**
+* The newest published snapshot, which stays unchanged until the next call.
+* Only one thread may read.
+*/
+RenderSnapshot *latestSnapshot(SnapshotExchange *x) {
+	if(snapshotFresh(x)) {
+		x->front = __atomic_exchange_n(&x->shared, x->front, __ATOMIC_ACQ_REL) & ~SNAPSHOT_FRESH;
+	}
+	return &x->snapshots[x->front];
+}
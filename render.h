@@ -0,0 +1,65 @@
+#ifndef __RENDER_H__
+#define __RENDER_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "mesh.h"
+
+/**
+* Indexed triangle buffers for drawing a mesh. Slot i of positions and normals
+* holds vertex i of the mesh, and indices holds three vertex slots per face in
+* mesh face order, so the arrays can be handed to a graphics API as they are.
+* Normals are the normalized sums of the normals of the faces around a vertex.
+*/
+typedef struct _renderbuffer {
+	int numVertices, numFaces;
+	int vertCapacity, faceCapacity;
+	float *positions;
+	float *normals;
+	uint32_t *indices;
+
+	/* Vertices whose normal is refreshed by the current update */
+	unsigned int epoch;
+	unsigned int *marks;
+	int *pending;
+	int numPending;
+} RenderBuffer;
+
+/**
+* Copy of render buffers that is not changed while a reader holds it.
+*/
+typedef struct _rendersnapshot {
+	int numVertices, numFaces;
+	int vertCapacity, faceCapacity;
+	float *positions;
+	float *normals;
+	uint32_t *indices;
+} RenderSnapshot;
+
+#define SNAPSHOT_FRESH 4 /* Set on the shared slot until the reader takes it */
+
+/**
+* Lock free handoff of snapshots from one writing thread to one drawing thread.
+* The three snapshots are held by the writer, by the reader and by a shared slot
+* that both sides only swap their own snapshot with by atomic exchange, so
+* neither side ever waits and the reader always gets the newest complete one.
+*/
+typedef struct _snapshotexchange {
+	RenderSnapshot snapshots[3];
+	int back; /* Snapshot owned by the writer */
+	int front; /* Snapshot owned by the reader */
+	int shared; /* Snapshot in the shared slot, or'ed with SNAPSHOT_FRESH when unread */
+} SnapshotExchange;
+
+RenderBuffer *initRenderBuffer(Mesh *m);
+void destroyRenderBuffer(RenderBuffer *rb, Mesh *m);
+void buildRenderBuffer(RenderBuffer *rb, Mesh *m);
+void updateRenderBuffer(RenderBuffer *rb, Mesh *m);
+
+SnapshotExchange *initSnapshotExchange(RenderBuffer *rb);
+void destroySnapshotExchange(SnapshotExchange *x);
+void publishSnapshot(SnapshotExchange *x, RenderBuffer *rb);
+int snapshotFresh(SnapshotExchange *x);
+RenderSnapshot *latestSnapshot(SnapshotExchange *x);
+
+#endif
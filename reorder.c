@@ -0,0 +1,182 @@
+#include "reorder.h"
+#include "stats.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/**
+* Spread the low ten bits of x out to every third bit.
+*/
+uint32_t spreadBits(uint32_t x) {
+	x &= 0x3FF;
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+/**
+* Position of v along a Morton curve through the bounding box.
+*/
+uint32_t mortonKey(Vertex *v, const float dimensions[6]) {
+	const float p[3] = {v->x, v->y, v->z};
+	uint32_t key = 0;
+	int i;
+	for(i = 0; i < 3; i++) {
+		float extent = dimensions[2 * i + 1] - dimensions[2 * i];
+		float t = extent > 0.0f ? (p[i] - dimensions[2 * i])/extent : 0.0f;
+		uint32_t cell = (uint32_t)(MAX(0.0f, MIN(t, 1.0f)) * ((1 << MORTON_BITS) - 1));
+		key |= spreadBits(cell) << i;
+	}
+	return key;
+}
+
+/**
+* Sort order, holding 0..n-1, by keys with a stable least significant digit
+* radix sort, one byte per pass.
+*/
+void radixSort(const uint32_t *keys, int *order, int n) {
+	int *buffer = (int*)malloc((n + 1) * sizeof(int));
+	int *from = order, *to = buffer, *swap;
+	int counts[257], shift, i;
+	for(shift = 0; shift < 32; shift += 8) {
+		memset(counts, 0, sizeof(counts));
+		for(i = 0; i < n; i++) counts[((keys[from[i]] >> shift) & 0xFF) + 1]++;
+		for(i = 0; i < 256; i++) counts[i + 1] += counts[i];
+		for(i = 0; i < n; i++) to[counts[(keys[from[i]] >> shift) & 0xFF]++] = from[i];
+		swap = from;
+		from = to;
+		to = swap;
+	}
+	/* An even number of passes leaves the result in order */
+	free(buffer);
+}
+
+/**
+* Store the elements of m in a new order for locality, and release the capacity
+* left unused by collapses. Vertices are sorted along a Morton curve through the
+* bounding box given by dimensions, faces follow the lowest numbered of their
+* vertices and the half edges of a face are stored together. Every element is
+* copied into freshly sized pools in that order, so neighbours in a ring
+* traversal share cache lines again, and the arrays and heap are renumbered.
+*
+* Refused, returning 0, while recording, as the recorder keeps pointers to
+* detached elements. Logged render changes are dropped, so an attached render
+* buffer must be rebuilt with buildRenderBuffer. Returns 1 once reordered.
+*/
+int reorderMesh(Mesh *m, const float dimensions[6]) {
+	int numVertices = m->numVertices, numFaces = m->numFaces, numEdges = m->numEdges;
+	int *vertOrder, *faceOrder, *counts, i, j, k;
+	uint32_t *keys;
+	Vertex **verts, **vertMap;
+	Face **faces, **faceMap;
+	Edge **edges, **edgeMap;
+	Pool vertPool, facePool, edgePool;
+
+	if(m->recorder != NULL) return 0;
+
+	/* Vertices along the curve, ties kept in their current order */
+	keys = (uint32_t*)calloc(numVertices + 1, sizeof(uint32_t));
+	vertOrder = (int*)malloc((numVertices + 1) * sizeof(int));
+	for(i = 0; i < numVertices; i++) {
+		keys[i] = mortonKey(m->verts[i], dimensions);
+		vertOrder[i] = i;
+	}
+	radixSort(keys, vertOrder, numVertices);
+	free(keys);
+
+	initPool(&vertPool, sizeof(Vertex), numVertices);
+	verts = (Vertex**)malloc((numVertices + 1) * sizeof(Vertex*));
+	vertMap = (Vertex**)malloc((numVertices + 1) * sizeof(Vertex*));
+	for(i = 0; i < numVertices; i++) {
+		Vertex *v = (Vertex*)poolAlloc(&vertPool);
+		*v = *m->verts[vertOrder[i]];
+		v->index = i;
+		verts[i] = v;
+		vertMap[vertOrder[i]] = v;
+	}
+	free(vertOrder);
+
+	/* Faces by their lowest new vertex, with a counting sort */
+	counts = (int*)calloc(numVertices + 1, sizeof(int));
+	faceOrder = (int*)malloc((numFaces + 1) * sizeof(int));
+	keys = (uint32_t*)malloc((numFaces + 1) * sizeof(uint32_t));
+	for(i = 0; i < numFaces; i++) {
+		Edge *edge = m->faces[i]->edge;
+		int a = vertMap[edge->vert->index]->index;
+		int b = vertMap[edge->next->vert->index]->index;
+		int c = vertMap[edge->prev->vert->index]->index;
+		keys[i] = MIN(a, MIN(b, c));
+		counts[keys[i] + 1]++;
+	}
+	for(i = 0; i < numVertices; i++) counts[i + 1] += counts[i];
+	for(i = 0; i < numFaces; i++) faceOrder[counts[keys[i]]++] = i;
+	free(counts);
+	free(keys);
+
+	initPool(&facePool, sizeof(Face), numFaces);
+	faces = (Face**)malloc((numFaces + 1) * sizeof(Face*));
+	faceMap = (Face**)malloc((numFaces + 1) * sizeof(Face*));
+	for(i = 0; i < numFaces; i++) {
+		Face *f = (Face*)poolAlloc(&facePool);
+		*f = *m->faces[faceOrder[i]];
+		f->index = i;
+		faces[i] = f;
+		faceMap[faceOrder[i]] = f;
+	}
+
+	/* The three half edges of each face in turn */
+	initPool(&edgePool, sizeof(Edge), numEdges);
+	edges = (Edge**)malloc((numEdges + 1) * sizeof(Edge*));
+	edgeMap = (Edge**)malloc((numEdges + 1) * sizeof(Edge*));
+	for(i = 0, k = 0; i < numFaces; i++) {
+		Edge *edge = m->faces[faceOrder[i]]->edge;
+		for(j = 0; j < 3; j++, k++) {
+			Edge *e = (Edge*)poolAlloc(&edgePool);
+			*e = *edge;
+			e->index = k;
+			edges[k] = e;
+			edgeMap[edge->index] = e;
+			edge = edge->next;
+		}
+	}
+	free(faceOrder);
+
+	/* Point the copies at each other, the old elements still hold their old indices */
+	for(i = 0; i < numVertices; i++) {
+		if(verts[i]->edge != NULL) verts[i]->edge = edgeMap[verts[i]->edge->index];
+	}
+	for(i = 0; i < numFaces; i++) faces[i]->edge = edgeMap[faces[i]->edge->index];
+	for(i = 0; i < numEdges; i++) {
+		Edge *e = edges[i];
+		e->vert = vertMap[e->vert->index];
+		e->face = faceMap[e->face->index];
+		e->prev = edgeMap[e->prev->index];
+		e->next = edgeMap[e->next->index];
+		e->pair = edgeMap[e->pair->index];
+	}
+	for(i = 0; i < m->heap->size; i++) m->heap->heap[i].edge = edgeMap[m->heap->heap[i].edge]->index;
+	STATS_MEMORY(((long long)numEdges - m->heap->capacity) * (long long)sizeof(HeapEntry));
+	m->heap->capacity = numEdges;
+	m->heap->heap = (HeapEntry*)realloc(m->heap->heap, (numEdges + 1) * sizeof(HeapEntry));
+	free(vertMap);
+	free(faceMap);
+	free(edgeMap);
+
+	destroyPool(&m->vertPool);
+	destroyPool(&m->facePool);
+	destroyPool(&m->edgePool);
+	free(m->verts);
+	free(m->faces);
+	free(m->edges);
+	m->vertPool = vertPool;
+	m->facePool = facePool;
+	m->edgePool = edgePool;
+	m->verts = verts;
+	m->faces = faces;
+	m->edges = edges;
+	m->numDirty = 0;
+	if(m->changes != NULL) m->changes->numVerts = m->changes->numFaces = 0;
+	return 1;
+}
@@ -0,0 +1,12 @@
+#ifndef __REORDER_H__
+#define __REORDER_H__
+
+#include <stdint.h>
+#include "types.h"
+#include "mesh.h"
+
+#define MORTON_BITS 10 /* Grid cells per axis of the Morton curve are 2^MORTON_BITS */
+
+int reorderMesh(Mesh *m, const float dimensions[6]);
+
+#endif
@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+unsigned long long statCounters[NUM_STAT_COUNTERS];
+unsigned long long statPhases[NUM_STAT_PHASES];
+unsigned long long statHistograms[NUM_STAT_LATENCIES][STAT_BUCKETS];
+long long statBytes, statPeakBytes;
+int statsRegistered = 0;
+
+const char *counterNames[NUM_STAT_COUNTERS] = {
+	"removeMin", "recalculateKey", "siftSteps", "costCalls", "collapsableCalls",
+	"collapsableRejects", "flipTests", "flips", "collapses", "rounds"
+};
+const char *phaseNames[NUM_STAT_PHASES] = {
+	"load", "link", "heap", "contract", "delaunay", "rekey", "write"
+};
+const char *latencyNames[NUM_STAT_LATENCIES] = {
+	"collapse", "round"
+};
+
+/**
+* Register the report to be written at exit. Safe to call more than once.
+*/
+void statsInit() {
+	if(!statsRegistered) {
+		statsRegistered = 1;
+		atexit(statsReport);
+	}
+}
+
+unsigned long long statsNow() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/**
+* Bucket of a duration in the latency histograms. Values below 8 ns get a bucket
+* each, larger ones are split into 8 buckets per power of two, so a bucket is
+* at most 12.5% wide.
+*/
+int statsBucket(unsigned long long nanoseconds) {
+	int e = 0;
+	if(nanoseconds < 8) return (int)nanoseconds;
+	while(nanoseconds >> (e + 1)) e++;
+	return 8 * (e - 2) + (int)((nanoseconds >> (e - 3)) & 7);
+}
+
+/**
+* Smallest duration falling in the given bucket.
+*/
+unsigned long long statsBucketStart(int bucket) {
+	if(bucket < 8) return bucket;
+	return (8ull + bucket % 8) << (bucket/8 - 1);
+}
+
+void statsLatency(StatLatency which, unsigned long long nanoseconds) {
+	__sync_fetch_and_add(&statHistograms[which][statsBucket(nanoseconds)], 1ull);
+}
+
+/**
+* Account for bytes allocated (positive) or released (negative) by the mesh.
+*/
+void statsMemory(long long bytes) {
+	long long current = __sync_add_and_fetch(&statBytes, bytes);
+	long long peak = statPeakBytes;
+	while(current > peak) {
+		long long seen = __sync_val_compare_and_swap(&statPeakBytes, peak, current);
+		if(seen == peak) break;
+		peak = seen;
+	}
+}
+
+/**
+* Start of the bucket holding the given fraction of the samples of a histogram.
+*/
+unsigned long long statsPercentile(const unsigned long long *histogram, unsigned long long total, double fraction) {
+	unsigned long long rank = (unsigned long long)(fraction * total), seen = 0;
+	int i;
+	for(i = 0; i < STAT_BUCKETS; i++) {
+		seen += histogram[i];
+		if(seen > rank) return statsBucketStart(i);
+	}
+	return 0;
+}
+
+void statsReport() {
+	static const double fractions[4] = {0.5, 0.9, 0.99, 0.999};
+	static const char *fractionNames[4] = {"p50", "p90", "p99", "p999"};
+	const char *fileName = getenv("MESH_STATS_FILE");
+	FILE *f = stderr;
+	struct rusage usage;
+	unsigned long long total, max;
+	int i, j;
+
+	if(fileName != NULL && (f = fopen(fileName, "w")) == NULL) {
+		printf("Could not open stats file %s for writing.\n", fileName);
+		return;
+	}
+	fprintf(f, "{\n\t\"counters\": {");
+	for(i = 0; i < NUM_STAT_COUNTERS; i++) {
+		fprintf(f, "%s\n\t\t\"%s\": %llu", i > 0 ? "," : "", counterNames[i], statCounters[i]);
+	}
+	fprintf(f, "\n\t},\n\t\"costCallsPerCollapse\": %.3f,\n",
+		statCounters[STAT_COLLAPSES] > 0 ? (double)statCounters[STAT_COST_CALLS]/statCounters[STAT_COLLAPSES] : 0.0);
+	fprintf(f, "\t\"phaseSeconds\": {");
+	for(i = 0; i < NUM_STAT_PHASES; i++) {
+		fprintf(f, "%s\n\t\t\"%s\": %.6f", i > 0 ? "," : "", phaseNames[i], statPhases[i]/1e9);
+	}
+	fprintf(f, "\n\t},\n\t\"latencyNanoseconds\": {");
+	for(i = 0; i < NUM_STAT_LATENCIES; i++) {
+		total = max = 0;
+		for(j = 0; j < STAT_BUCKETS; j++) {
+			total += statHistograms[i][j];
+			if(statHistograms[i][j] > 0) max = statsBucketStart(j);
+		}
+		fprintf(f, "%s\n\t\t\"%s\": {\"samples\": %llu", i > 0 ? "," : "", latencyNames[i], total);
+		for(j = 0; j < 4; j++) {
+			fprintf(f, ", \"%s\": %llu", fractionNames[j], statsPercentile(statHistograms[i], total, fractions[j]));
+		}
+		fprintf(f, ", \"max\": %llu}", max);
+	}
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(f, "\n\t},\n\t\"peakMeshBytes\": %lld,\n\t\"peakResidentBytes\": %lld\n}\n",
+		statPeakBytes, (long long)usage.ru_maxrss * 1024);
+	if(f != stderr) fclose(f);
+}
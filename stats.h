@@ -0,0 +1,75 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+/**
+* Hot path counters and phase timers. They are only compiled in when building
+* with -DMESH_STATS (make DEFINES=-DMESH_STATS), otherwise every STATS_ macro
+* expands to nothing. A JSON report is written to stderr at exit, or to the
+* file named by the MESH_STATS_FILE environment variable.
+*
+* Counters and timers may be updated from the parallel phases, phase times are
+* therefore summed over threads rather than wall time.
+*/
+
+typedef enum _statcounter {
+	STAT_REMOVE_MIN,
+	STAT_RECALCULATE_KEY,
+	STAT_SIFT_STEPS,
+	STAT_COST_CALLS,
+	STAT_COLLAPSABLE_CALLS,
+	STAT_COLLAPSABLE_REJECTS,
+	STAT_FLIP_TESTS,
+	STAT_FLIPS,
+	STAT_COLLAPSES,
+	STAT_ROUNDS,
+	NUM_STAT_COUNTERS
+} StatCounter;
+
+typedef enum _statphase {
+	PHASE_LOAD,
+	PHASE_LINK,
+	PHASE_HEAP,
+	PHASE_CONTRACT,
+	PHASE_DELAUNAY,
+	PHASE_REKEY,
+	PHASE_WRITE,
+	NUM_STAT_PHASES
+} StatPhase;
+
+typedef enum _statlatency {
+	LATENCY_COLLAPSE,
+	LATENCY_ROUND,
+	NUM_STAT_LATENCIES
+} StatLatency;
+
+/* Log-linear histogram, 8 buckets per power of two of nanoseconds */
+#define STAT_BUCKETS 496
+
+extern unsigned long long statCounters[NUM_STAT_COUNTERS];
+extern unsigned long long statPhases[NUM_STAT_PHASES];
+
+void statsInit();
+unsigned long long statsNow();
+void statsLatency(StatLatency which, unsigned long long nanoseconds);
+void statsMemory(long long bytes);
+void statsReport();
+
+#ifdef MESH_STATS
+#define STATS_INIT() statsInit()
+#define STATS_COUNT(counter) __sync_fetch_and_add(&statCounters[(counter)], 1ull)
+#define STATS_ADD(counter, n) __sync_fetch_and_add(&statCounters[(counter)], (unsigned long long)(n))
+#define STATS_START(timer) unsigned long long timer = statsNow()
+#define STATS_PHASE(phase, timer) __sync_fetch_and_add(&statPhases[(phase)], statsNow() - (timer))
+#define STATS_LATENCY(which, timer) statsLatency((which), statsNow() - (timer))
+#define STATS_MEMORY(bytes) statsMemory((long long)(bytes))
+#else
+#define STATS_INIT() ((void)0)
+#define STATS_COUNT(counter) ((void)0)
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_START(timer)
+#define STATS_PHASE(phase, timer) ((void)0)
+#define STATS_LATENCY(which, timer) ((void)0)
+#define STATS_MEMORY(bytes) ((void)0)
+#endif
+
+#endif
@@ -1,26 +1,38 @@
 #ifndef __TYPES_H__
 #define __TYPES_H__
 
-struct _edgenode;
+#include <stddef.h>
+
+struct _mesh;
+
+typedef struct _pool {
+	size_t elementSize;
+	int blockElements; /* Elements carved from each block */
+	int used; /* Elements carved from the newest block */
+	int numBlocks, blockCapacity;
+	char **blocks;
+	void *freeList; /* Released elements, linked through their first word */
+} Pool;
 
 typedef struct _edge {
 	int index;
+	int heapIndex; /* Position in the edge heap, or -1 if not present */
+	unsigned int stamp; /* Epoch of the last re-key pass that visited this edge */
 	struct _vertex *vert;
 	struct _face *face;
 	struct _edge *prev, *next, *pair;
-	struct _edgenode *heapNode;
 } Edge;
 
-typedef struct _edgenode {
-	int index;
+typedef struct _heapentry {
 	float cost;
-	Edge* edge;
-} EdgeNode;
+	int edge; /* Index of the edge in the mesh edge array */
+} HeapEntry;
 
 typedef struct _edgeheap {
 	int capacity;
 	int size;
-	EdgeNode **heap;
+	HeapEntry *heap;
+	struct _mesh *mesh;
 	float (*func)(Edge*); /* Pointer to edge evaluation function */
 	int (*test)(Edge*); /* Pointer to edge collapsability test function */
 } Heap;
@@ -28,20 +40,84 @@ typedef struct _edgeheap {
 typedef struct _vertex {
 	int index;
 	float x, y, z;
+	double quadric[10]; /* Upper triangle of the symmetric 4x4 error quadric, row major */
+	unsigned int stamp; /* Epoch of the last pass that claimed this vertex */
+	int snapshot; /* Entry of the current position in a LOD export, or -1 once it moves */
+	int locked; /* Never collapsed, set on the seams of out of core chunks */
 	struct _edge *edge;
 } Vertex;
 
 typedef struct _face {
 	int index;
+	float normal[3]; /* Cached unit normal, valid unless stale is set */
+	int stale;
 	struct _edge *edge;
 } Face;
 
+/**
+* State needed to undo one edge flip exactly: the flipped edge, and the edge
+* pointers of its two faces and two original endpoints before the flip.
+*/
+typedef struct _fliprecord {
+	struct _edge *edge;
+	struct _edge *vertEdge[2];
+	struct _edge *faceEdge[2];
+} FlipRecord;
+
+typedef struct _fliplog {
+	FlipRecord *flips;
+	int numFlips, capacity;
+} FlipLog;
+
+/**
+* One recorded collapse, read backwards it is a vertex split. The elements cut
+* out by the collapse are kept unchanged while recorded, so the edge is enough
+* to find them again. The flips done by the Delaunay pass after the collapse
+* end at flipEnd in the flip log.
+*/
+typedef struct _collapserecord {
+	struct _edge *edge;
+	float from[3], to[3]; /* Position of the surviving vertex before and after */
+	double quadric[10]; /* Quadric of the surviving vertex before, restored exactly by an undo */
+	int flipEnd;
+	unsigned char links; /* CONTRACT_* bits for the element pointers that were moved */
+} CollapseRecord;
+
+typedef struct _recorder {
+	CollapseRecord *records;
+	int numRecords, capacity;
+	int current; /* Records applied to the mesh, later ones were undone */
+	FlipLog flips;
+	int detached; /* The heap was emptied by a replay and must be rebuilt before reducing */
+} Recorder;
+
+/**
+* Vertices and faces whose render data changed since a render buffer last caught
+* up with the mesh. A vertex entry covers the faces of its 2-ring.
+*/
+typedef struct _changelog {
+	struct _vertex **verts;
+	int numVerts, vertCapacity;
+	struct _face **faces;
+	int numFaces, faceCapacity;
+} ChangeLog;
+
 typedef struct _mesh {
 	int numEdges, numVertices, numFaces;
 	struct _edge **edges;
 	struct _face **faces;
 	struct _vertex **verts;
+	Pool edgePool, facePool, vertPool;
 	Heap *heap;
+	
+	/* Dirty set of half edges gathered for re-keying after a collapse */
+	unsigned int epoch;
+	int numDirty, dirtyCapacity;
+	struct _edge **dirty;
+	unsigned long rekeyed, rekeySkipped; /* Key evaluations done and duplicates avoided */
+	
+	Recorder *recorder; /* Collapse history, or NULL when not recording */
+	ChangeLog *changes; /* Changes for a render buffer, or NULL when none is attached */
 } Mesh;
 
 #endif